@@ -0,0 +1,284 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "aot.h"
+#include "debug.h"
+#include "object.h"
+#include "value.h"
+
+static const char* prelude =
+    "#include <math.h>\n"
+    "#include <stdio.h>\n"
+    "\n"
+    "#include \"chunk.h\"\n"
+    "#include \"object.h\"\n"
+    "#include \"vm.h\"\n"
+    "\n"
+    "// vm->ip and vm->stackTop as run() would have them at the instruction at\n"
+    "// offset, set before anything that can allocate or report an error\n"
+    "#define AT(offset, depth) (vm->ip = code + (offset) + 1, vm->stackTop = sp + (depth))\n"
+    "#define FAIL(offset, depth, message) do { \\\n"
+    "    AT(offset, depth); \\\n"
+    "    runtimeError(vm, message); \\\n"
+    "    return INTERPRET_RUNTIME_ERROR; \\\n"
+    "} while (false)\n"
+    "#define FALSEY(value) (IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)))\n"
+    "\n";
+
+// a C expression for constant index
+static void emitConstant(Chunk* chunk, int index, FILE* out) {
+    Value value = chunk->constants.values[index];
+    if (!IS_NUMBER(value) || isnan(AS_NUMBER(value))) {
+        // strings, and NaNs to keep their bits
+        fprintf(out, "k[%d]", index);
+    } else if (isinf(AS_NUMBER(value))) {
+        fprintf(out, "NUMBER_VAL(%sINFINITY)", AS_NUMBER(value) < 0 ? "-" : "");
+    } else {
+        // hex floats are exact
+        fprintf(out, "NUMBER_VAL(%a)", AS_NUMBER(value));
+    }
+}
+
+// constants are never ropes
+static void emitString(ObjString* string, FILE* out) {
+    fputc('"', out);
+    for (int i = 0; i < string->length; i++) {
+        unsigned char c = (unsigned char)string->chars[i];
+        if (c >= ' ' && c <= '~' && c != '"' && c != '\\' && c != '?') {
+            fputc(c, out);
+        } else {
+            fprintf(out, "\\%03o", c);
+        }
+    }
+    fputc('"', out);
+}
+
+static void emitData(Chunk* chunk, FILE* out) {
+    fprintf(out, "static uint8_t code[%d] = {", chunk->count);
+    for (int i = 0; i < chunk->count; i++) {
+        fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", chunk->code[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static LineStart lines[%d] = {\n", chunk->lineCount);
+    for (int i = 0; i < chunk->lineCount; i++) {
+        fprintf(out, "    {%d, %d},\n", chunk->lines[i].offset, chunk->lines[i].line);
+    }
+    fprintf(out, "};\n\n");
+
+    // shared strings belong to no vm, any number of them can run the script
+    fprintf(out, "static Value constants[%d];\n\n", chunk->constants.count > 0 ? chunk->constants.count : 1);
+    fprintf(out, "static Chunk chunk;\n\n");
+    fprintf(out, "void loadScript() {\n");
+    fprintf(out, "    initChunk(&chunk);\n");
+    fprintf(out, "    chunk.code = code;\n");
+    fprintf(out, "    chunk.count = chunk.capacity = %d;\n", chunk->count);
+    fprintf(out, "    chunk.lines = lines;\n");
+    fprintf(out, "    chunk.lineCount = chunk.lineCapacity = %d;\n", chunk->lineCount);
+    fprintf(out, "    chunk.constants.values = constants;\n");
+    fprintf(out, "    chunk.constants.count = chunk.constants.capacity = %d;\n", chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value value = chunk->constants.values[i];
+        fprintf(out, "    constants[%d] = ", i);
+        if (IS_NUMBER(value)) {
+            double number = AS_NUMBER(value);
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            // from the bits, NaNs included
+            fprintf(out, "NUMBER_VAL(((union { uint64_t bits; double number; }){.bits = 0x%016llxull}).number)",
+                    (unsigned long long)bits);
+        } else {
+            ObjString* string = AS_STRING(value);
+            fprintf(out, "OBJ_VAL(newSharedString(");
+            emitString(string, out);
+            fprintf(out, ", %d))", string->length);
+        }
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "void freeScript() {\n");
+    fprintf(out, "    // everything is static but the strings\n");
+    fprintf(out, "    for (int i = 0; i < chunk.constants.count; i++) {\n");
+    fprintf(out, "        if (IS_STRING(constants[i])) freeSharedString(AS_STRING(constants[i]));\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    initChunk(&chunk);\n");
+    fprintf(out, "}\n\n");
+}
+
+static const char* numberOperator(uint8_t opcode) {
+    switch (opcode) {
+        case OP_SUBTRACT: return "NUMBER_VAL(%s - %s)";
+        case OP_MULTIPLY: return "NUMBER_VAL(%s * %s)";
+        case OP_DIVIDE: return "NUMBER_VAL(%s / %s)";
+        case OP_LESS: return "BOOL_VAL(%s < %s)";
+        case OP_GREATER: return "BOOL_VAL(%s > %s)";
+        // the same as run(), NaN compares false both ways
+        case OP_LESS_EQUAL: return "BOOL_VAL(!(%s > %s))";
+        case OP_GREATER_EQUAL: return "BOOL_VAL(!(%s < %s))";
+        default: return NULL;
+    }
+}
+
+// one instruction at stack depth, false for an opcode it can't translate
+static bool emitInstruction(Chunk* chunk, int offset, int depth, FILE* out) {
+    uint8_t opcode = chunk->code[offset];
+    // slots of the top two values
+    int a = depth - 2;
+    int b = depth - 1;
+
+    fprintf(out, "    // %04d %s\n", offset, opcodeName(opcode));
+    switch (opcode) {
+        case OP_RETURN:
+            fprintf(out, "    AT(%d, %d);\n", offset, depth);
+            fprintf(out, "    printResult(vm);\n");
+            fprintf(out, "    return INTERPRET_SUCCESS;\n");
+            return true;
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+            fprintf(out, "    sp[%d] = ", depth);
+            emitConstant(chunk, opcode == OP_CONSTANT ? chunk->code[offset + 1] : readLong(chunk, offset + 1), out);
+            fprintf(out, ";\n");
+            return true;
+        case OP_TRUE: fprintf(out, "    sp[%d] = BOOL_VAL(true);\n", depth); return true;
+        case OP_FALSE: fprintf(out, "    sp[%d] = BOOL_VAL(false);\n", depth); return true;
+        case OP_NIL: fprintf(out, "    sp[%d] = NIL_VAL();\n", depth); return true;
+        case OP_NEGATE:
+            fprintf(out, "    if (!IS_NUMBER(sp[%d])) FAIL(%d, %d, \"Operand must be a number.\");\n", b, offset, depth);
+            fprintf(out, "    sp[%d] = NUMBER_VAL(-AS_NUMBER(sp[%d]));\n", b, b);
+            return true;
+        case OP_NOT:
+            fprintf(out, "    sp[%d] = BOOL_VAL(FALSEY(sp[%d]));\n", b, b);
+            return true;
+        case OP_AND:
+        case OP_OR:
+            return true;
+        case OP_ADD:
+            fprintf(out, "    if (IS_NUMBER(sp[%d]) && IS_NUMBER(sp[%d])) {\n", a, b);
+            fprintf(out, "        sp[%d] = NUMBER_VAL(AS_NUMBER(sp[%d]) + AS_NUMBER(sp[%d]));\n", a, a, b);
+            fprintf(out, "    } else {\n");
+            fprintf(out, "        AT(%d, %d);\n", offset, depth);
+            fprintf(out, "        if (!addValues(vm)) return INTERPRET_RUNTIME_ERROR;\n");
+            fprintf(out, "    }\n");
+            return true;
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+            fprintf(out, "    if (IS_NUMBER(sp[%d]) && IS_NUMBER(sp[%d])) {\n", a, b);
+            fprintf(out, "        sp[%d] = BOOL_VAL(AS_NUMBER(sp[%d]) %s AS_NUMBER(sp[%d]));\n",
+                    a, a, opcode == OP_EQUAL ? "==" : "!=", b);
+            // chained comparisons compare bools, keep them out of the vm too
+            fprintf(out, "    } else if (IS_BOOL(sp[%d]) && IS_BOOL(sp[%d])) {\n", a, b);
+            fprintf(out, "        sp[%d] = BOOL_VAL(AS_BOOL(sp[%d]) %s AS_BOOL(sp[%d]));\n",
+                    a, a, opcode == OP_EQUAL ? "==" : "!=", b);
+            fprintf(out, "    } else {\n");
+            fprintf(out, "        AT(%d, %d);\n", offset, depth);
+            fprintf(out, "        equalValues(vm, %s);\n", opcode == OP_EQUAL ? "false" : "true");
+            fprintf(out, "    }\n");
+            return true;
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_LESS:
+        case OP_GREATER:
+        case OP_LESS_EQUAL:
+        case OP_GREATER_EQUAL: {
+            char left[32];
+            char right[32];
+            snprintf(left, sizeof(left), "AS_NUMBER(sp[%d])", a);
+            snprintf(right, sizeof(right), "AS_NUMBER(sp[%d])", b);
+            fprintf(out, "    if (!IS_NUMBER(sp[%d]) || !IS_NUMBER(sp[%d])) FAIL(%d, %d, \"Operands must be number.\");\n",
+                    a, b, offset, depth);
+            fprintf(out, "    sp[%d] = ", a);
+            fprintf(out, numberOperator(opcode), left, right);
+            fprintf(out, ";\n");
+            return true;
+        }
+        case OP_ADD_CONST:
+            fprintf(out, "    {\n");
+            fprintf(out, "        Value b = ");
+            emitConstant(chunk, chunk->code[offset + 1], out);
+            fprintf(out, ";\n");
+            fprintf(out, "        if (IS_NUMBER(b) && IS_NUMBER(sp[%d])) {\n", b);
+            fprintf(out, "            sp[%d] = NUMBER_VAL(AS_NUMBER(sp[%d]) + AS_NUMBER(b));\n", b, b);
+            fprintf(out, "        } else {\n");
+            fprintf(out, "            sp[%d] = b;\n", depth);
+            fprintf(out, "            AT(%d, %d);\n", offset, depth + 1);
+            fprintf(out, "            if (!addValues(vm)) return INTERPRET_RUNTIME_ERROR;\n");
+            fprintf(out, "        }\n");
+            fprintf(out, "    }\n");
+            return true;
+        case OP_MULTIPLY_CONST:
+            fprintf(out, "    {\n");
+            fprintf(out, "        Value b = ");
+            emitConstant(chunk, chunk->code[offset + 1], out);
+            fprintf(out, ";\n");
+            fprintf(out, "        if (!IS_NUMBER(b) || !IS_NUMBER(sp[%d])) FAIL(%d, %d, \"Operands must be number.\");\n",
+                    b, offset, depth);
+            fprintf(out, "        sp[%d] = NUMBER_VAL(AS_NUMBER(sp[%d]) * AS_NUMBER(b));\n", b, b);
+            fprintf(out, "    }\n");
+            return true;
+        case OP_ADD_N: {
+            int count = chunk->code[offset + 1];
+            int first = depth - count;
+            fprintf(out, "    if (IS_NUMBER(sp[%d])", first);
+            for (int i = first + 1; i < depth; i++) fprintf(out, " && IS_NUMBER(sp[%d])", i);
+            fprintf(out, ") {\n");
+            fprintf(out, "        sp[%d] = NUMBER_VAL(AS_NUMBER(sp[%d])", first, first);
+            for (int i = first + 1; i < depth; i++) fprintf(out, " + AS_NUMBER(sp[%d])", i);
+            fprintf(out, ");\n");
+            fprintf(out, "    } else {\n");
+            fprintf(out, "        AT(%d, %d);\n", offset, depth);
+            fprintf(out, "        if (!addN(vm, %d)) return INTERPRET_RUNTIME_ERROR;\n", count);
+            fprintf(out, "    }\n");
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool emitC(Chunk* chunk, const char* sourceName, FILE* out) {
+    fprintf(out, "// generated by clox --emit-c from %s\n", sourceName);
+    fputs(prelude, out);
+    emitData(chunk, out);
+
+    // the stack depth is known at every instruction, values are addressed
+    // from the bottom of the stack
+    fprintf(out, "static InterpretResult runChunk(VM* vm) {\n");
+    fprintf(out, "    Value* const sp = STACK_BASE(vm);\n");
+    fprintf(out, "    Value* const k = chunk.constants.values;\n");
+    fprintf(out, "    (void)k;\n");
+    int depth = 0;
+    for (int offset = 0; offset < chunk->count; offset += opcodeLength(chunk->code[offset])) {
+        int pops;
+        int pushes;
+        if (!stackEffect(chunk, offset, &pops, &pushes) || depth < pops ||
+            !emitInstruction(chunk, offset, depth, out)) {
+            return false;
+        }
+        depth += pushes - pops;
+    }
+    fprintf(out, "}\n\n");
+
+    fprintf(out,
+        "InterpretResult runScript(VM* vm) {\n"
+        "    vm->chunk = &chunk;\n"
+        "    InterpretResult result = runChunk(vm);\n"
+        "    vm->chunk = NULL;\n"
+        "    return result;\n"
+        "}\n"
+        "\n"
+        "#ifndef CLOX_AOT_NO_MAIN\n"
+        "int main() {\n"
+        "    static VM vm;\n"
+        "    initVM(&vm);\n"
+        "    loadScript();\n"
+        "    InterpretResult result = runScript(&vm);\n"
+        "    freeScript();\n"
+        "    freeVM(&vm);\n"
+        "    return result == INTERPRET_RUNTIME_ERROR ? 70 : 0;\n"
+        "}\n"
+        "#endif\n");
+    return !ferror(out);
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#ifndef clox_aot_h
+#define clox_aot_h
+
+#include <stdio.h>
+
+#include "chunk.h"
+
+// ahead-of-time compilation to C. every instruction of the chunk becomes
+// straight-line C on the vm's value stack, with the same type checks as
+// run() and the same calls into the vm for strings, equality and errors.
+// the code and line table are embedded so errors report the same lines.
+//
+// the output defines
+//   void loadScript(), builds the constants as shared strings
+//   InterpretResult runScript(VM* vm), any number of vms can run it at once
+//   void freeScript(), after the last run
+// and a main() running the script once unless CLOX_AOT_NO_MAIN is defined.
+// it links against every object of clox but main.o, build/<config>/libclox.a
+// in the Makefile, built with the same Value layout flags.
+bool emitC(Chunk* chunk, const char* sourceName, FILE* out);
+
+#endif
\ No newline at end of file
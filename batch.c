@@ -0,0 +1,277 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "vm.h"
+
+// blocks of one worker in ascending order. the owner and thieves both take
+// from head, the lowest block is the one the writer needs first.
+typedef struct {
+    pthread_mutex_t lock;
+    int* blocks;
+    int head;
+    int count;
+} Deque;
+
+// output of a finished block
+typedef struct {
+    bool done;
+    char* out;
+    size_t outLength;
+    char* err;
+    size_t errLength;
+    bool hadCompileError;
+    bool hadRuntimeError;
+} Slot;
+
+// a line of the source and its line number in the file
+typedef struct {
+    char* source;
+    int number;
+} Line;
+
+typedef struct {
+    Line* lines;
+    int lineCount;
+    int blockCount;
+    int workerCount;
+    Deque* deques;
+
+    // reorder buffer, block b finishes into slots[b % window]
+    pthread_mutex_t lock;
+    // signaled when a block is done and when one is written
+    pthread_cond_t slotDone;
+    pthread_cond_t slotFree;
+    Slot* slots;
+    int window;
+    // blocks written so far, blocks up to written + window may run
+    int written;
+} Batch;
+
+typedef struct {
+    Batch* batch;
+    int id;
+    pthread_t thread;
+} Worker;
+
+////////////////////
+// Lines
+///////////////////
+
+static bool isBlank(const char* line) {
+    for (; *line != '\0'; line++) {
+        if (*line != ' ' && *line != '\t' && *line != '\r') return false;
+    }
+    return true;
+}
+
+// NUL-terminate every line in place, the scanner needs a NUL after the last char
+static Line* splitLines(char* source, int* count) {
+    int capacity = 0;
+    Line* lines = NULL;
+    *count = 0;
+    int number = 1;
+    for (char* start = source; *start != '\0'; number++) {
+        char* end = strchr(start, '\n');
+        char* next = end != NULL ? end + 1 : start + strlen(start);
+        if (end != NULL) *end = '\0';
+        if (!isBlank(start)) {
+            if (*count == capacity) {
+                capacity = capacity < 8 ? 8 : capacity * 2;
+                lines = (Line*)realloc(lines, sizeof(Line) * capacity);
+                if (lines == NULL) exit(1);
+            }
+            lines[(*count)++] = (Line){start, number};
+        }
+        start = next;
+    }
+    return lines;
+}
+
+////////////////////
+// Work stealing
+///////////////////
+
+// blocks are dealt out round robin, neighbouring blocks run side by side and
+// reach the writer at about the same time
+static void initDeques(Batch* batch) {
+    batch->deques = (Deque*)malloc(sizeof(Deque) * batch->workerCount);
+    if (batch->deques == NULL) exit(1);
+    for (int i = 0; i < batch->workerCount; i++) {
+        Deque* deque = &batch->deques[i];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->blocks = (int*)malloc(sizeof(int) * (batch->blockCount / batch->workerCount + 1));
+        if (deque->blocks == NULL) exit(1);
+        deque->head = 0;
+        deque->count = 0;
+        for (int block = i; block < batch->blockCount; block += batch->workerCount) {
+            deque->blocks[deque->count++] = block;
+        }
+    }
+}
+
+static void freeDeques(Batch* batch) {
+    for (int i = 0; i < batch->workerCount; i++) {
+        pthread_mutex_destroy(&batch->deques[i].lock);
+        free(batch->deques[i].blocks);
+    }
+    free(batch->deques);
+}
+
+static bool popBlock(Deque* deque, int* block) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->head < deque->count;
+    if (found) *block = deque->blocks[deque->head++];
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// own blocks first, then steal from the others starting with the next
+// worker. false once every deque is empty.
+static bool takeBlock(Batch* batch, int id, int* block) {
+    for (int i = 0; i < batch->workerCount; i++) {
+        if (popBlock(&batch->deques[(id + i) % batch->workerCount], block)) return true;
+    }
+    return false;
+}
+
+////////////////////
+// Reorder buffer
+///////////////////
+
+// a worker only ever waits for blocks below its own. deques are taken from
+// their low end and a worker only steals once its own is empty, so the
+// lowest unwritten block is running or next in line for a worker that is
+// not waiting, and the writer gets to it.
+static void waitForSlot(Batch* batch, int block) {
+    pthread_mutex_lock(&batch->lock);
+    while (block >= batch->written + batch->window) {
+        pthread_cond_wait(&batch->slotFree, &batch->lock);
+    }
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void finishBlock(Batch* batch, int block, Slot* result) {
+    pthread_mutex_lock(&batch->lock);
+    result->done = true;
+    batch->slots[block % batch->window] = *result;
+    pthread_cond_signal(&batch->slotDone);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+// write blocks in order as they finish, return the exit code of the batch
+static int writeBlocks(Batch* batch) {
+    bool hadCompileError = false;
+    bool hadRuntimeError = false;
+    for (int block = 0; block < batch->blockCount; block++) {
+        Slot* slot = &batch->slots[block % batch->window];
+        pthread_mutex_lock(&batch->lock);
+        while (!slot->done) pthread_cond_wait(&batch->slotDone, &batch->lock);
+        Slot result = *slot;
+        slot->done = false;
+        batch->written++;
+        pthread_cond_broadcast(&batch->slotFree);
+        pthread_mutex_unlock(&batch->lock);
+
+        fwrite(result.out, 1, result.outLength, stdout);
+        fwrite(result.err, 1, result.errLength, stderr);
+        free(result.out);
+        free(result.err);
+        hadCompileError |= result.hadCompileError;
+        hadRuntimeError |= result.hadRuntimeError;
+    }
+    if (hadCompileError) return 65;
+    if (hadRuntimeError) return 70;
+    return 0;
+}
+
+////////////////////
+// Workers
+///////////////////
+
+static void runBlock(Batch* batch, VM* vm, int block) {
+    Slot result = {0};
+    vm->out = open_memstream(&result.out, &result.outLength);
+    vm->err = open_memstream(&result.err, &result.errLength);
+    if (vm->out == NULL || vm->err == NULL) exit(1);
+
+    int end = (block + 1) * BATCH_BLOCK_LINES;
+    if (end > batch->lineCount) end = batch->lineCount;
+    for (int line = block * BATCH_BLOCK_LINES; line < end; line++) {
+        vm->firstLine = batch->lines[line].number;
+        InterpretResult interpreted = interpret(vm, batch->lines[line].source);
+        if (interpreted == INTERPRET_COMPILE_ERROR) result.hadCompileError = true;
+        if (interpreted == INTERPRET_RUNTIME_ERROR) result.hadRuntimeError = true;
+    }
+
+    fclose(vm->out);
+    fclose(vm->err);
+    vm->out = stdout;
+    vm->err = stderr;
+    finishBlock(batch, block, &result);
+}
+
+static void* runWorker(void* argument) {
+    Worker* worker = (Worker*)argument;
+    Batch* batch = worker->batch;
+    // the value stack is inline, keep it off the thread's stack
+    VM* vm = (VM*)malloc(sizeof(VM));
+    if (vm == NULL) exit(1);
+    initVM(vm);
+
+    int block;
+    while (takeBlock(batch, worker->id, &block)) {
+        waitForSlot(batch, block);
+        runBlock(batch, vm, block);
+    }
+
+    freeVM(vm);
+    free(vm);
+    return NULL;
+}
+
+int runBatch(char* source, int threads) {
+    Batch batch;
+    batch.lines = splitLines(source, &batch.lineCount);
+    batch.blockCount = (batch.lineCount + BATCH_BLOCK_LINES - 1) / BATCH_BLOCK_LINES;
+    if (batch.blockCount == 0) return 0;
+
+    batch.workerCount = threads < batch.blockCount ? threads : batch.blockCount;
+    if (batch.workerCount < 1) batch.workerCount = 1;
+    initDeques(&batch);
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.slotDone, NULL);
+    pthread_cond_init(&batch.slotFree, NULL);
+    batch.window = batch.workerCount * BATCH_WINDOW_BLOCKS;
+    batch.slots = (Slot*)calloc(batch.window, sizeof(Slot));
+    if (batch.slots == NULL) exit(1);
+    batch.written = 0;
+
+    // the blocks of a worker that is missing would be left waiting in its
+    // deque behind the others' window, every worker has to start
+    Worker* workers = (Worker*)malloc(sizeof(Worker) * batch.workerCount);
+    if (workers == NULL) exit(1);
+    for (int i = 0; i < batch.workerCount; i++) {
+        workers[i] = (Worker){.batch = &batch, .id = i};
+        if (pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]) != 0) {
+            fprintf(stderr, "Could not start worker threads.\n");
+            exit(1);
+        }
+    }
+
+    int status = writeBlocks(&batch);
+
+    for (int i = 0; i < batch.workerCount; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    free(workers);
+    free(batch.slots);
+    pthread_cond_destroy(&batch.slotFree);
+    pthread_cond_destroy(&batch.slotDone);
+    pthread_mutex_destroy(&batch.lock);
+    freeDeques(&batch);
+    free(batch.lines);
+    return status;
+}
\ No newline at end of file
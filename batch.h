@@ -0,0 +1,25 @@
+#ifndef clox_batch_h
+#define clox_batch_h
+
+#include "common.h"
+
+// batch evaluation. every line of the source is a script of its own, lines
+// are run by a pool of worker threads with a vm each and their results and
+// errors are written to stdout and stderr in the order of the lines.
+//
+// lines are handed out in blocks of BATCH_BLOCK_LINES. every worker owns a
+// deque of blocks and takes the lowest one, an idle worker steals the lowest
+// block of another. finished blocks wait in a reorder buffer of
+// BATCH_WINDOW_BLOCKS per worker until every block before them is written,
+// a worker that gets too far ahead waits for the writer.
+
+#define BATCH_BLOCK_LINES 64
+#define BATCH_WINDOW_BLOCKS 8
+
+// source is split at its newlines in place and must stay alive until the
+// call returns. blank lines are skipped, errors report the line number of
+// the line in source. returns the exit code of the
+// batch, 65 if a line fails to compile, else 70 if one fails to run.
+int runBatch(char* source, int threads);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+// measures instructions per second of C written by clox --emit-c against
+// run() and the jit on the same chunk. link it with the emitted file of the
+// script given on the command line, built with -DCLOX_AOT_NO_MAIN and at the
+// same optimization level as the chunk compiled here, see bench/aot.sh.
+// usage: bench-aot file [runs]
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "jit.h"
+#include "vm.h"
+#include "stats.h"
+
+static VM vm;
+
+// defined by the emitted file
+void loadScript();
+InterpretResult runScript(VM* vm);
+void freeScript();
+
+// straight-line code runs every instruction exactly once
+static int countInstructions(Chunk* chunk) {
+    int count = 0;
+    for (int offset = 0; offset < chunk->count; offset += opcodeLength(chunk->code[offset])) {
+        count++;
+    }
+    return count;
+}
+
+static void report(const char* name, int instructions, int runs, double elapsed) {
+    fprintf(stderr, "%-24s %6d instructions %8.1f M instructions/s\n",
+            name, instructions, (double)instructions * runs / elapsed / 1e6);
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bench-aot file [runs]\n");
+        return 64;
+    }
+    int runs = argc > 2 ? atoi(argv[2]) : 10000;
+    char* source = readSource(argv[1]);
+    char workload[256];
+    workloadName(argv[1], workload, sizeof(workload));
+
+    // every run prints its result, keep it out of the report
+    if (freopen("/dev/null", "w", stdout) == NULL) return 1;
+
+    initVM(&vm);
+    // the workloads are all literals, keep the compiler from folding them away
+    optimizationLevel = 0;
+    Chunk chunk;
+    initChunk(&chunk);
+    if (!compile(&vm, source, &chunk)) {
+        fprintf(stderr, "%s: compile failed\n", argv[1]);
+        return 65;
+    }
+    int instructions = countInstructions(&chunk);
+    char name[300];
+
+    double start = now();
+    for (int i = 0; i < runs; i++) {
+        if (interpretChunk(&vm, &chunk) != INTERPRET_SUCCESS) {
+            fprintf(stderr, "%s: run failed\n", argv[1]);
+            return 70;
+        }
+    }
+    snprintf(name, sizeof(name), "run/%s", workload);
+    report(name, instructions, runs, now() - start);
+
+    JitCode jit;
+    if (compileJit(&chunk, &jit)) {
+        vm.chunk = &chunk;
+        start = now();
+        for (int i = 0; i < runs; i++) {
+            vm.stackTop = STACK_BASE(&vm);
+            if (jit.function(&vm) != INTERPRET_SUCCESS) {
+                fprintf(stderr, "%s: jit run failed\n", argv[1]);
+                return 70;
+            }
+        }
+        vm.chunk = NULL;
+        snprintf(name, sizeof(name), "jit/%s", workload);
+        report(name, instructions, runs, now() - start);
+        freeJit(&jit);
+    }
+
+    loadScript();
+    start = now();
+    for (int i = 0; i < runs; i++) {
+        if (runScript(&vm) != INTERPRET_SUCCESS) {
+            fprintf(stderr, "%s: aot run failed\n", argv[1]);
+            return 70;
+        }
+    }
+    snprintf(name, sizeof(name), "aot/%s", workload);
+    report(name, instructions, runs, now() - start);
+    freeScript();
+
+    freeChunk(&vm, &chunk);
+    freeVM(&vm);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# compiles the bench workloads to C with clox --emit-c and times the native
+# code against run() and the jit, see bench/aot.c. the workloads are kept
+# short, every one becomes a single C function.
+# usage: bench/aot.sh [runs] [terms]
+set -e
+cd "$(dirname "$0")/.."
+
+CC=${CC:-cc}
+OUT=${TMPDIR:-/tmp}/clox_aot
+RUNS=${1:-10000}
+TERMS=${2:-200}
+SRC=$(ls *.c | grep -v "^main.c$")
+FLAGS="-std=gnu11 -O2 -DNDEBUG $CFLAGS"
+
+mkdir -p "$OUT"
+for file in $SRC; do
+    $CC $FLAGS -c "$file" -o "$OUT/${file%.c}.o"
+done
+rm -f "$OUT/libclox.a"
+ar rcs "$OUT/libclox.a" "$OUT"/*.o
+$CC $FLAGS main.c "$OUT/libclox.a" -lm -o "$OUT/clox"
+
+sh bench/workloads.sh "$OUT/workloads" "$TERMS"
+for script in "$OUT"/workloads/*.lox; do
+    name=$(basename "$script" .lox)
+    "$OUT/clox" -O0 --emit-c="$OUT/$name.c" "$script"
+    $CC $FLAGS -DCLOX_AOT_NO_MAIN -I. bench/aot.c "$OUT/$name.c" "$OUT/libclox.a" -lm -o "$OUT/bench-aot-$name"
+    "$OUT/bench-aot-$name" "$script" "$RUNS"
+done
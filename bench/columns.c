@@ -0,0 +1,133 @@
+// evaluates an expression over many rows, once per row with interpret() and
+// the values spliced into the source, and with runColumns() and every column
+// kernel set the cpu supports. usage: bench-columns [rows] [iterations]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "column.h"
+#include "compiler.h"
+#include "object.h"
+#include "vm.h"
+#include "stats.h"
+
+static const char* kernelNames[] = {
+    [COLUMN_SCALAR] = "scalar",
+    [COLUMN_SSE2] = "sse2",
+    [COLUMN_AVX2] = "avx2",
+};
+
+static const char* columnNames[] = {"x", "y"};
+
+typedef struct {
+    const char* name;
+    const char* source;
+    // the same expression with %s in place of x and y
+    const char* format;
+    bool strings;
+} Workload;
+
+static const Workload workloads[] = {
+    {"numbers", "x * 2 + y * y < x + 100", "%s * 2 + %s * %s < %s + 100", false},
+    {"strings", "x + y == \"ab\" + y", "%s + %s == \"ab\" + %s", true},
+};
+
+static VM vm;
+
+int main(int argc, const char* argv[]) {
+    int rows = argc > 1 ? atoi(argv[1]) : 100000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 20;
+    if (rows < 1 || iterations < 1) {
+        fprintf(stderr, "Usage: bench-columns [rows] [iterations]\n");
+        return 64;
+    }
+    double* samples = (double*)malloc(sizeof(double) * iterations);
+    Value* columns[2];
+    Value* results = (Value*)malloc(sizeof(Value) * rows);
+    char (*literals)[2][32] = (char (*)[2][32])malloc(sizeof(*literals) * rows);
+    if (samples == NULL || results == NULL || literals == NULL) exit(1);
+
+    initVM(&vm);
+    vm.out = fopen("/dev/null", "w");
+    if (vm.out == NULL) exit(1);
+    for (int c = 0; c < 2; c++) {
+        columns[c] = (Value*)malloc(sizeof(Value) * rows);
+        if (columns[c] == NULL) exit(1);
+    }
+    // the inputs are roots while they are built and run one row at a time
+    ValueSpan inputs[2] = {{columns[0], 0}, {columns[1], 0}};
+    vm.roots = inputs;
+    vm.rootCount = 2;
+
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        const Workload* workload = &workloads[w];
+        srand(1);
+        for (int row = 0; row < rows; row++) {
+            for (int c = 0; c < 2; c++) {
+                int number = rand() % 1000;
+                if (workload->strings) {
+                    snprintf(literals[row][c], sizeof(literals[row][c]), "\"%c%d\"", 'a' + number % 3, number % 7);
+                    int length = (int)strlen(literals[row][c]) - 2;
+                    columns[c][row] = OBJ_VAL(copyString(&vm, literals[row][c] + 1, length));
+                } else {
+                    snprintf(literals[row][c], sizeof(literals[row][c]), "%d", number);
+                    columns[c][row] = NUMBER_VAL(number);
+                }
+                inputs[c].count = row + 1;
+            }
+        }
+
+        char source[256];
+        for (int i = 0; i < iterations; i++) {
+            double start = now();
+            for (int row = 0; row < rows; row++) {
+                const char* x = literals[row][0];
+                const char* y = literals[row][1];
+                if (workload->strings) {
+                    snprintf(source, sizeof(source), workload->format, x, y, y);
+                } else {
+                    snprintf(source, sizeof(source), workload->format, x, y, y, x);
+                }
+                interpret(&vm, source);
+            }
+            samples[i] = now() - start;
+        }
+        char name[300];
+        snprintf(name, sizeof(name), "columns/interpret/%s", workload->name);
+        printStats(name, samples, iterations);
+
+        Chunk chunk;
+        initChunk(&chunk);
+        if (!compileColumns(&vm, workload->source, columnNames, 2, &chunk)) {
+            fprintf(stderr, "%s: compile failed\n", workload->name);
+            return 65;
+        }
+        for (int kernels = COLUMN_SCALAR; kernels <= COLUMN_AVX2; kernels++) {
+            if (!useColumnKernels((ColumnKernels)kernels)) continue;
+
+            for (int i = 0; i < iterations; i++) {
+                double start = now();
+                if (runColumns(&vm, &chunk, columns, 2, rows, results, NULL) != 0) {
+                    fprintf(stderr, "%s: rows failed\n", workload->name);
+                    return 70;
+                }
+                samples[i] = now() - start;
+            }
+            snprintf(name, sizeof(name), "columns/%s/%s", kernelNames[kernels], workload->name);
+            printStats(name, samples, iterations);
+        }
+        freeChunk(&vm, &chunk);
+    }
+
+    vm.roots = NULL;
+    vm.rootCount = 0;
+    fclose(vm.out);
+    freeVM(&vm);
+    for (int c = 0; c < 2; c++) free(columns[c]);
+    free(literals);
+    free(results);
+    free(samples);
+    return 0;
+}
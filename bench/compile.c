@@ -0,0 +1,50 @@
+// compiles a file over and over without running it, at -O0 and -O1.
+// usage: bench-compile file [iterations]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "vm.h"
+#include "stats.h"
+
+static VM vm;
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bench-compile file [iterations]\n");
+        return 64;
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : 20;
+    char* source = readSource(argv[1]);
+    char workload[256];
+    workloadName(argv[1], workload, sizeof(workload));
+    double* samples = (double*)malloc(sizeof(double) * iterations);
+
+    initVM(&vm);
+    for (int level = 0; level <= 1; level++) {
+        optimizationLevel = level;
+        for (int i = 0; i < iterations; i++) {
+            Chunk chunk;
+            initChunk(&chunk);
+            double start = now();
+            if (!compile(&vm, source, &chunk)) {
+                fprintf(stderr, "%s: compile failed\n", argv[1]);
+                return 65;
+            }
+            samples[i] = now() - start;
+            freeChunk(&vm, &chunk);
+        }
+
+        char name[300];
+        snprintf(name, sizeof(name), "compile-O%d/%s", level, workload);
+        printStats(name, samples, iterations);
+    }
+    freeVM(&vm);
+
+    free(samples);
+    free(source);
+    return 0;
+}
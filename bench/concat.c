@@ -0,0 +1,99 @@
+// builds large strings through long chains of +, build it once with ropes and
+// once with -DROPE_MIN_LENGTH=2147483647 to always copy, see bench/concat.sh.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "compiler.h"
+#include "object.h"
+#include "vm.h"
+
+static VM vm;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// "aaa..." + "bbb..." + ... terms strings of the given length.
+// nested wraps every step in parentheses, ((("aaa" + "bbb") + "ccc") + ...),
+// which compiles to one OP_ADD per step instead of a single OP_ADD_N.
+static char* chainSource(int terms, int length, bool nested) {
+    char* source = malloc((size_t)terms * (length + 6) + 1);
+    int offset = 0;
+    if (nested) {
+        memset(source, '(', terms - 1);
+        offset += terms - 1;
+    }
+    for (int i = 0; i < terms; i++) {
+        if (i > 1 && nested) source[offset++] = ')';
+        if (i > 0) offset += sprintf(source + offset, "+");
+        source[offset++] = '"';
+        memset(source + offset, 'a' + i % 26, length);
+        offset += length;
+        source[offset++] = '"';
+    }
+    if (nested && terms > 1) source[offset++] = ')';
+    source[offset] = '\0';
+    return source;
+}
+
+// (chain) == (chain) compares the two results, which needs their content
+static char* equalitySource(int terms, int length) {
+    char* chain = chainSource(terms, length, true);
+    char* source = malloc(strlen(chain) * 2 + 8);
+    sprintf(source, "(%s) == (%s)", chain, chain);
+    free(chain);
+    return source;
+}
+
+static void bench(const char* name, const char* source, int runs) {
+    double start = now();
+    for (int i = 0; i < runs; i++) {
+        if (interpret(&vm, source) != INTERPRET_SUCCESS) {
+            fprintf(stderr, "%s: interpret failed\n", name);
+            exit(1);
+        }
+    }
+    double elapsed = now() - start;
+    fprintf(stderr, "%-28s %10.1f us/run\n", name, elapsed / runs * 1e6);
+}
+
+int main(int argc, const char* argv[]) {
+    int runs = argc > 1 ? atoi(argv[1]) : 200;
+
+    // every run prints its result, keep it out of the report
+    if (freopen("/dev/null", "w", stdout) == NULL) return 1;
+
+    fprintf(stderr, "ROPE_MIN_LENGTH = %d\n", ROPE_MIN_LENGTH);
+
+    initVM(&vm);
+    // the expressions are all literals, keep the compiler from folding them away
+    optimizationLevel = 0;
+    char* small = chainSource(250, 16, true);
+    char* medium = chainSource(250, 200, true);
+    char* large = chainSource(250, 2000, true);
+    char* flat = chainSource(250, 2000, false);
+    // longer than one OP_ADD_N, every one after the first adds to the sum so far
+    char* longChain = chainSource(50000, 16, false);
+    char* equality = equalitySource(120, 500);
+
+    bench("250 x 16 chars", small, runs);
+    bench("250 x 200 chars", medium, runs);
+    bench("250 x 2000 chars", large, runs);
+    bench("250 x 2000 chars, OP_ADD_N", flat, runs);
+    bench("50000 x 16 chars, OP_ADD_N", longChain, runs / 20 + 1);
+    bench("2 x 120 x 500 chars, ==", equality, runs);
+
+    free(small);
+    free(medium);
+    free(large);
+    free(flat);
+    free(longChain);
+    free(equality);
+    freeVM(&vm);
+    return 0;
+}
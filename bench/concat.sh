@@ -0,0 +1,15 @@
+#!/bin/sh
+# builds bench/concat.c with ropes and with flat copying and runs both.
+# usage: bench/concat.sh [runs]
+set -e
+cd "$(dirname "$0")/.."
+
+CC=${CC:-cc}
+OUT=${TMPDIR:-/tmp}
+SRC=$(ls *.c | grep -v "^main.c$")
+
+$CC -std=gnu11 -O2 -DNDEBUG $CFLAGS -I. $SRC bench/concat.c -o "$OUT/clox_concat_rope"
+$CC -std=gnu11 -O2 -DNDEBUG -DROPE_MIN_LENGTH=2147483647 $CFLAGS -I. $SRC bench/concat.c -o "$OUT/clox_concat_flat"
+
+"$OUT/clox_concat_rope" "$@"
+"$OUT/clox_concat_flat" "$@"
@@ -0,0 +1,120 @@
+// measures instructions per second of run() on precompiled chunks, build it
+// once with threaded dispatch and once with -DDISPATCH_SWITCH, see
+// bench/dispatch.sh. the same chunks are also run as jit code, compiled once.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "jit.h"
+#include "vm.h"
+
+static VM vm;
+
+#define TERMS 200
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// straight-line code runs every instruction exactly once
+static int countInstructions(Chunk* chunk) {
+    int count = 0;
+    for (int offset = 0; offset < chunk->count; offset += opcodeLength(chunk->code[offset])) {
+        count++;
+    }
+    return count;
+}
+
+// -1 + -2 * 3 - -4 / 5 ... a long arithmetic expression with negations
+static char* arithmeticSource() {
+    static const char* ops[] = {" + ", " * -", " - ", " / -"};
+    char* source = malloc(TERMS * 16);
+    int length = sprintf(source, "-1");
+    for (int i = 2; i <= TERMS; i++) {
+        length += sprintf(source + length, "%s%d", ops[i % 4], i);
+    }
+    return source;
+}
+
+// !(1 < 2) == (3 >= 4) != !(5 > 6) ... comparisons and nots
+static char* comparisonSource() {
+    static const char* ops[] = {" < ", " >= ", " > ", " <= "};
+    char* source = malloc(TERMS * 24);
+    int length = sprintf(source, "true");
+    for (int i = 1; i + 1 <= TERMS; i += 2) {
+        length += sprintf(source + length, " %s !(%d%s%d)", i % 4 == 1 ? "==" : "!=", i, ops[i % 4], i + 1);
+    }
+    return source;
+}
+
+static void bench(const char* name, const char* source, int runs) {
+    Chunk chunk;
+    initChunk(&chunk);
+    if (!compile(&vm, source, &chunk)) {
+        fprintf(stderr, "%s: compile failed\n", name);
+        exit(1);
+    }
+    int instructions = countInstructions(&chunk);
+
+    double start = now();
+    for (int i = 0; i < runs; i++) {
+        if (interpretChunk(&vm, &chunk) != INTERPRET_SUCCESS) {
+            fprintf(stderr, "%s: run failed\n", name);
+            exit(1);
+        }
+    }
+    double elapsed = now() - start;
+    fprintf(stderr, "%-12s %6d instructions %8.1f M instructions/s\n",
+            name, instructions, (double)instructions * runs / elapsed / 1e6);
+
+    JitCode jit;
+    if (compileJit(&chunk, &jit)) {
+        vm.chunk = &chunk;
+        start = now();
+        for (int i = 0; i < runs; i++) {
+            vm.stackTop = STACK_BASE(&vm);
+            if (jit.function(&vm) != INTERPRET_SUCCESS) {
+                fprintf(stderr, "%s: jit run failed\n", name);
+                exit(1);
+            }
+        }
+        elapsed = now() - start;
+        vm.chunk = NULL;
+        fprintf(stderr, "%-12s %6d instructions %8.1f M instructions/s\n",
+                "  jit", instructions, (double)instructions * runs / elapsed / 1e6);
+        freeJit(&jit);
+    }
+    freeChunk(&vm, &chunk);
+}
+
+int main(int argc, const char* argv[]) {
+    int runs = argc > 1 ? atoi(argv[1]) : 100000;
+
+    // every run prints its result, keep it out of the report
+    if (freopen("/dev/null", "w", stdout) == NULL) return 1;
+
+    #ifdef THREADED_DISPATCH
+    fprintf(stderr, "threaded dispatch\n");
+    #else
+    fprintf(stderr, "switch dispatch\n");
+    #endif
+
+    initVM(&vm);
+    // the expressions are all literals, keep the compiler from folding them away
+    optimizationLevel = 0;
+    char* arithmetic = arithmeticSource();
+    char* comparison = comparisonSource();
+
+    bench("arithmetic", arithmetic, runs);
+    bench("comparison", comparison, runs);
+
+    free(arithmetic);
+    free(comparison);
+    freeVM(&vm);
+    return 0;
+}
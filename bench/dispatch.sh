@@ -0,0 +1,15 @@
+#!/bin/sh
+# builds bench/dispatch.c with threaded and with switch dispatch and runs both.
+# usage: bench/dispatch.sh [runs]
+set -e
+cd "$(dirname "$0")/.."
+
+CC=${CC:-cc}
+OUT=${TMPDIR:-/tmp}
+SRC=$(ls *.c | grep -v "^main.c$")
+
+$CC -std=gnu11 -O2 -DNDEBUG $CFLAGS -I. $SRC bench/dispatch.c -o "$OUT/clox_dispatch_threaded"
+$CC -std=gnu11 -O2 -DNDEBUG -DDISPATCH_SWITCH $CFLAGS -I. $SRC bench/dispatch.c -o "$OUT/clox_dispatch_switch"
+
+"$OUT/clox_dispatch_threaded" "$@"
+"$OUT/clox_dispatch_switch" "$@"
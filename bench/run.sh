@@ -0,0 +1,33 @@
+#!/bin/sh
+# runs a command repeatedly and prints one result line: name, then median,
+# p99, mean and standard deviation of the wall time in ms, then the number
+# of runs. the command's output is discarded, a failing run stops it.
+# usage: bench/run.sh [-n runs] name command [args...]
+set -e
+
+RUNS=10
+if [ "$1" = "-n" ]; then
+    RUNS=$2
+    shift 2
+fi
+NAME=${1:?usage: bench/run.sh [-n runs] name command [args...]}
+shift
+
+i=0
+while [ $i -lt "$RUNS" ]; do
+    start=$(date +%s%N)
+    "$@" > /dev/null 2>&1 || { echo "$NAME: command failed: $*" >&2; exit 1; }
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000 ))
+    i=$((i + 1))
+done | sort -n | awk -v name="$NAME" '
+    { us[NR] = $1; sum += $1 }
+    END {
+        n = NR
+        median = n % 2 ? us[(n + 1) / 2] : (us[n / 2] + us[n / 2 + 1]) / 2
+        rank = int(n * 0.99); if (rank < n * 0.99) rank++; if (rank < 1) rank = 1
+        mean = sum / n
+        for (i = 1; i <= n; i++) squares += (us[i] - mean) ^ 2
+        stddev = n > 1 ? sqrt(squares / (n - 1)) : 0
+        printf "%-36s %10.3f %10.3f %10.3f %10.3f %5d\n", name, median / 1e3, us[rank] / 1e3, mean / 1e3, stddev / 1e3, n
+    }'
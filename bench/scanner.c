@@ -0,0 +1,47 @@
+// tokenizes a file with every scanner kernel the cpu supports, without
+// compiling. usage: bench-scanner file [iterations]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "scanner.h"
+#include "stats.h"
+
+static const char* kernelNames[] = {
+    [SCAN_SCALAR] = "scalar",
+    [SCAN_SSE2] = "sse2",
+    [SCAN_AVX2] = "avx2",
+};
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bench-scanner file [iterations]\n");
+        return 64;
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : 20;
+    char* source = readSource(argv[1]);
+    char workload[256];
+    workloadName(argv[1], workload, sizeof(workload));
+    double* samples = (double*)malloc(sizeof(double) * iterations);
+
+    for (int kernels = SCAN_SCALAR; kernels <= SCAN_AVX2; kernels++) {
+        if (!useScanKernels((ScanKernels)kernels)) continue;
+
+        for (int i = 0; i < iterations; i++) {
+            double start = now();
+            Scanner scanner;
+            initScanner(&scanner, source);
+            while (scanToken(&scanner).type != TOKEN_EOF);
+            samples[i] = now() - start;
+        }
+
+        char name[300];
+        snprintf(name, sizeof(name), "scan/%s/%s", kernelNames[kernels], workload);
+        printStats(name, samples, iterations);
+    }
+
+    free(samples);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,71 @@
+// timing summary shared by the microbenchmarks, prints the same columns as
+// bench/run.sh so bench/suite.sh can collect and compare them.
+#ifndef clox_bench_stats_h
+#define clox_bench_stats_h
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compareSamples(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// samples in seconds, sorted in place. p99 is the nearest rank.
+static void printStats(const char* name, double* samples, int count) {
+    qsort(samples, count, sizeof(double), compareSamples);
+    double median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    int rank = (int)ceil(count * 0.99);
+    double p99 = samples[(rank < 1 ? 1 : rank) - 1];
+
+    double sum = 0;
+    for (int i = 0; i < count; i++) sum += samples[i];
+    double mean = sum / count;
+    double squares = 0;
+    for (int i = 0; i < count; i++) squares += (samples[i] - mean) * (samples[i] - mean);
+    double stddev = count > 1 ? sqrt(squares / (count - 1)) : 0;
+
+    printf("%-36s %10.3f %10.3f %10.3f %10.3f %5d\n",
+           name, median * 1e3, p99 * 1e3, mean * 1e3, stddev * 1e3, count);
+    fflush(stdout);
+}
+
+static char* readSource(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file %s.\n", path);
+        exit(74);
+    }
+    fseek(file, 0L, SEEK_END);
+    size_t size = ftell(file);
+    rewind(file);
+    char* buffer = (char*)malloc(size + 1);
+    if (buffer == NULL || fread(buffer, 1, size, file) != size) {
+        fprintf(stderr, "Could not read file %s.\n", path);
+        exit(74);
+    }
+    buffer[size] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+// file name without directories or extension, names the result line
+static void workloadName(const char* path, char* buffer, size_t size) {
+    const char* slash = strrchr(path, '/');
+    const char* base = slash == NULL ? path : slash + 1;
+    const char* dot = strrchr(base, '.');
+    int length = dot == NULL ? (int)strlen(base) : (int)(dot - base);
+    snprintf(buffer, size, "%.*s", length, base);
+}
+
+#endif
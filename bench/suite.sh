@@ -0,0 +1,66 @@
+#!/bin/sh
+# runs the whole benchmark suite against a build directory holding clox,
+# bench-scanner, bench-compile and bench-columns, see the bench target of
+# the Makefile.
+#   -n runs      repetitions of every benchmark, default 10
+#   -o file      also write the results to file
+#   -b file      compare the medians against results written earlier
+# usage: bench/suite.sh [-n runs] [-o results] [-b baseline] build_dir
+set -e
+
+RUNS=10
+RESULTS=
+BASELINE=
+while getopts "n:o:b:" option; do
+    case $option in
+        n) RUNS=$OPTARG ;;
+        o) RESULTS=$OPTARG ;;
+        b) BASELINE=$OPTARG ;;
+        *) exit 64 ;;
+    esac
+done
+shift $((OPTIND - 1))
+BUILD=${1:?usage: bench/suite.sh [-n runs] [-o results] [-b baseline] build_dir}
+BENCH=$(dirname "$0")
+WORKLOADS="arithmetic comparison concat constants"
+
+sh "$BENCH/workloads.sh" "$BUILD/workloads"
+OUT=$(mktemp)
+trap 'rm -f "$OUT"' EXIT
+
+{
+    printf "%-36s %10s %10s %10s %10s %5s\n" name median_ms p99_ms mean_ms stddev_ms runs
+    for workload in $WORKLOADS; do
+        file="$BUILD/workloads/$workload.lox"
+        rm -f "$BUILD/workloads/$workload.loxc"
+        sh "$BENCH/run.sh" -n "$RUNS" "run/$workload" "$BUILD/clox" "$file"
+        sh "$BENCH/run.sh" -n "$RUNS" "run-O0/$workload" "$BUILD/clox" -O0 "$file"
+        sh "$BENCH/run.sh" -n "$RUNS" "run-jit/$workload" "$BUILD/clox" --jit "$file"
+        # run again from the .loxc cache, it has to be newer than the source
+        sleep 0.01
+        "$BUILD/clox" --compile-only "$file"
+        sh "$BENCH/run.sh" -n "$RUNS" "run-cached/$workload" "$BUILD/clox" "$file"
+        rm -f "$BUILD/workloads/$workload.loxc"
+    done
+    for workload in $WORKLOADS; do
+        "$BUILD/bench-scanner" "$BUILD/workloads/$workload.lox" "$RUNS"
+    done
+    for workload in $WORKLOADS; do
+        "$BUILD/bench-compile" "$BUILD/workloads/$workload.lox" "$RUNS"
+    done
+    "$BUILD/bench-columns" 100000 "$RUNS"
+} | tee "$OUT"
+
+if [ -n "$RESULTS" ]; then
+    cp "$OUT" "$RESULTS"
+fi
+
+if [ -n "$BASELINE" ]; then
+    echo
+    printf "%-36s %10s %10s %8s\n" "median vs $BASELINE" baseline_ms current_ms change
+    awk 'NR == FNR { if (FNR > 1) baseline[$1] = $2; next }
+         FNR > 1 && ($1 in baseline) {
+             change = baseline[$1] > 0 ? ($2 - baseline[$1]) / baseline[$1] * 100 : 0
+             printf "%-36s %10.3f %10.3f %+7.1f%%\n", $1, baseline[$1], $2, change
+         }' "$BASELINE" "$OUT"
+fi
@@ -0,0 +1,100 @@
+// compares the cost of the Value representation on arithmetic-heavy and
+// stack-heavy scripts, build it once with and once without -DNAN_BOXING,
+// see bench/value.sh.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "compiler.h"
+#include "value.h"
+#include "vm.h"
+
+static VM vm;
+
+#define TERMS 200
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 1 + 2 * 3 - 4 / 5 + 6 * 7 ... keeps the stack shallow
+static char* arithmeticSource() {
+    static const char* ops[] = {" + ", " * ", " - ", " / "};
+    char* source = malloc(TERMS * 16);
+    int length = sprintf(source, "1");
+    for (int i = 2; i <= TERMS; i++) {
+        length += sprintf(source + length, "%s%d", ops[i % 4], i);
+    }
+    return source;
+}
+
+// (1 + (2 + (3 + ...))) pushes every operand before the first add
+static char* stackSource() {
+    char* source = malloc(TERMS * 16);
+    int length = 0;
+    for (int i = 1; i < TERMS; i++) {
+        length += sprintf(source + length, "(%d + ", i);
+    }
+    length += sprintf(source + length, "%d", TERMS);
+    for (int i = 1; i < TERMS; i++) {
+        source[length++] = ')';
+    }
+    source[length] = '\0';
+    return source;
+}
+
+// 1 < 2 == (3 > 4) == (5 < 6) ... mixes numbers and booleans
+static char* comparisonSource() {
+    char* source = malloc(TERMS * 24);
+    int length = sprintf(source, "1 < 2");
+    for (int i = 3; i + 1 <= TERMS; i += 2) {
+        length += sprintf(source + length, " == (%d %s %d)", i, i % 4 == 1 ? "<" : ">", i + 1);
+    }
+    return source;
+}
+
+static void bench(const char* name, const char* source, int runs) {
+    double start = now();
+    for (int i = 0; i < runs; i++) {
+        if (interpret(&vm, source) != INTERPRET_SUCCESS) {
+            fprintf(stderr, "%s: interpret failed\n", name);
+            exit(1);
+        }
+    }
+    double elapsed = now() - start;
+    fprintf(stderr, "%-12s %10.1f ns/run\n", name, elapsed / runs * 1e9);
+}
+
+int main(int argc, const char* argv[]) {
+    int runs = argc > 1 ? atoi(argv[1]) : 20000;
+
+    // every run prints its result, keep it out of the report
+    if (freopen("/dev/null", "w", stdout) == NULL) return 1;
+
+    #ifdef NAN_BOXING
+    fprintf(stderr, "NaN-boxed Value, sizeof(Value) = %zu\n", sizeof(Value));
+    #else
+    fprintf(stderr, "tagged union Value, sizeof(Value) = %zu\n", sizeof(Value));
+    #endif
+
+    initVM(&vm);
+    // the expressions are all literals, keep the compiler from folding them away
+    optimizationLevel = 0;
+    char* arithmetic = arithmeticSource();
+    char* stack = stackSource();
+    char* comparison = comparisonSource();
+
+    bench("arithmetic", arithmetic, runs);
+    bench("stack", stack, runs);
+    bench("comparison", comparison, runs);
+
+    free(arithmetic);
+    free(stack);
+    free(comparison);
+    freeVM(&vm);
+    return 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# builds bench/value.c against the tagged union and the NaN-boxed Value and runs both.
+# usage: bench/value.sh [runs]
+set -e
+cd "$(dirname "$0")/.."
+
+CC=${CC:-cc}
+OUT=${TMPDIR:-/tmp}
+SRC=$(ls *.c | grep -v "^main.c$")
+
+$CC -std=gnu11 -O2 -DNDEBUG -I. $SRC bench/value.c -o "$OUT/clox_value_union"
+$CC -std=gnu11 -O2 -DNDEBUG -DNAN_BOXING -I. $SRC bench/value.c -o "$OUT/clox_value_nan"
+
+"$OUT/clox_value_union" "$@"
+"$OUT/clox_value_nan" "$@"
@@ -0,0 +1,47 @@
+#!/bin/sh
+# writes the Lox workloads of the benchmark suite into a directory.
+# a script is a single expression, so each workload is one long one.
+# usage: bench/workloads.sh dir [terms]
+set -e
+DIR=${1:?usage: bench/workloads.sh dir [terms]}
+TERMS=${2:-50000}
+mkdir -p "$DIR"
+
+# i * 2 - i / 3 + ..., ten terms per line
+awk -v n="$TERMS" 'BEGIN {
+    for (i = 1; i <= n; i++) {
+        printf "%s%d * 2 - %d / 3", (i > 1 ? " + " : ""), i, i
+        if (i % 10 == 0) printf "\n"
+    }
+    printf "\n"
+}' > "$DIR/arithmetic.lox"
+
+# true == (1 < 2) != !(2 >= 3) == ...
+awk -v n="$TERMS" 'BEGIN {
+    printf "true"
+    for (i = 1; i <= n; i++) {
+        if (i % 2) printf " == (%d < %d)", i, i + 1
+        else printf " != !(%d >= %d)", i, i * 2
+        if (i % 10 == 0) printf "\n"
+    }
+    printf "\n"
+}' > "$DIR/comparison.lox"
+
+# "item 1, " + "item 2, " + ...
+awk -v n="$TERMS" 'BEGIN {
+    for (i = 1; i <= n; i++) {
+        printf "%s\"item %d, \"", (i > 1 ? " + " : ""), i
+        if (i % 10 == 0) printf "\n"
+    }
+    printf "\n"
+}' > "$DIR/concat.lox"
+
+# distinct numbers and strings, the pool needs OP_CONSTANT_LONG
+awk -v n="$TERMS" 'BEGIN {
+    printf "true"
+    for (i = 1; i <= n; i++) {
+        printf " == (\"k%d\" != \"k%d\") == (%d.5 < %d.25)", i, i + n, i, i + 1
+        if (i % 10 == 0) printf "\n"
+    }
+    printf "\n"
+}' > "$DIR/constants.lox"
@@ -0,0 +1,291 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#define CONSTANT_NUMBER 0
+#define CONSTANT_STRING 1
+
+// FNV-1a
+static uint32_t checksum(const uint8_t* bytes, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+////////////////////
+// Write
+///////////////////
+
+typedef struct {
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+} Buffer;
+
+static void append(Buffer* buffer, const void* bytes, size_t length) {
+    if (buffer->count + length > buffer->capacity) {
+        while (buffer->count + length > buffer->capacity) {
+            buffer->capacity = buffer->capacity < 64 ? 64 : buffer->capacity * 2;
+        }
+        buffer->bytes = (uint8_t*)realloc(buffer->bytes, buffer->capacity);
+        if (buffer->bytes == NULL) exit(1);
+    }
+    memcpy(buffer->bytes + buffer->count, bytes, length);
+    buffer->count += length;
+}
+
+static bool appendConstant(Buffer* buffer, Value value) {
+    uint8_t tag;
+    if (IS_NUMBER(value)) {
+        tag = CONSTANT_NUMBER;
+        double number = AS_NUMBER(value);
+        append(buffer, &tag, 1);
+        append(buffer, &number, sizeof(double));
+        return true;
+    }
+    if (IS_STRING(value)) {
+        tag = CONSTANT_STRING;
+        ObjString* string = AS_STRING(value);
+        uint32_t length = (uint32_t)string->length;
+        append(buffer, &tag, 1);
+        append(buffer, &length, sizeof(uint32_t));
+        // constants are never ropes
+        append(buffer, string->chars, length);
+        return true;
+    }
+    return false;
+}
+
+bool writeChunkFile(Chunk* chunk, const char* path) {
+    Buffer payload = {NULL, 0, 0};
+    append(&payload, chunk->lines, sizeof(LineStart) * chunk->lineCount);
+    append(&payload, chunk->code, chunk->count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        if (!appendConstant(&payload, chunk->constants.values[i])) {
+            free(payload.bytes);
+            return false;
+        }
+    }
+
+    ChunkFileHeader header;
+    memcpy(header.magic, "LOXC", 4);
+    header.version = CHUNK_FILE_VERSION;
+    header.optimizationLevel = (uint32_t)optimizationLevel;
+    header.codeLength = (uint32_t)chunk->count;
+    header.lineCount = (uint32_t)chunk->lineCount;
+    header.constantCount = (uint32_t)chunk->constants.count;
+    header.payloadLength = (uint32_t)payload.count;
+    header.checksum = checksum(payload.bytes, payload.count);
+
+    // write next to the target and rename, a reader never sees half a file
+    size_t tempSize = strlen(path) + 5;
+    char* temp = (char*)malloc(tempSize);
+    if (temp == NULL) exit(1);
+    snprintf(temp, tempSize, "%s.tmp", path);
+
+    bool written = false;
+    FILE* file = fopen(temp, "wb");
+    if (file != NULL) {
+        written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(payload.bytes, 1, payload.count, file) == payload.count;
+        written = fclose(file) == 0 && written;
+        written = written && rename(temp, path) == 0;
+        if (!written) remove(temp);
+    }
+    free(temp);
+    free(payload.bytes);
+    return written;
+}
+
+////////////////////
+// Load
+///////////////////
+
+static bool readConstants(VM* vm, Chunk* chunk, const uint8_t* cursor, const uint8_t* end, uint32_t count) {
+    // the chunk isn't a root until it runs, hold collections off until then
+    bool wasCollecting = vm->collecting;
+    vm->collecting = true;
+
+    bool valid = true;
+    for (uint32_t i = 0; i < count && valid; i++) {
+        if (cursor == end) {
+            valid = false;
+            break;
+        }
+        switch(*cursor++) {
+            case CONSTANT_NUMBER: {
+                double number;
+                if ((size_t)(end - cursor) < sizeof(double)) {
+                    valid = false;
+                    break;
+                }
+                memcpy(&number, cursor, sizeof(double));
+                cursor += sizeof(double);
+                writeValueArray(vm, &chunk->constants, NUMBER_VAL(number));
+                break;
+            }
+            case CONSTANT_STRING: {
+                uint32_t length;
+                if ((size_t)(end - cursor) < sizeof(uint32_t)) {
+                    valid = false;
+                    break;
+                }
+                memcpy(&length, cursor, sizeof(uint32_t));
+                cursor += sizeof(uint32_t);
+                if (length > INT32_MAX || (size_t)(end - cursor) < length) {
+                    valid = false;
+                    break;
+                }
+                ObjString* string = copyString(vm, (const char*)cursor, (int)length);
+                cursor += length;
+                writeValueArray(vm, &chunk->constants, OBJ_VAL(string));
+                break;
+            }
+            default: valid = false; break;
+        }
+    }
+
+    vm->collecting = wasCollecting;
+    return valid && cursor == end;
+}
+
+// stack effect of the instruction at offset, false if it isn't a valid
+// instruction or refers to a missing constant
+static bool instructionEffect(Chunk* chunk, int offset, int* pops, int* pushes) {
+    if (!stackEffect(chunk, offset, pops, pushes)) return false;
+    switch(chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_ADD_CONST:
+        case OP_MULTIPLY_CONST:
+            return chunk->code[offset + 1] < chunk->constants.count;
+        case OP_CONSTANT_LONG:
+            return readLong(chunk, offset + 1) < chunk->constants.count;
+        default: return true;
+    }
+}
+
+// code is straight-line, so walking it once proves every instruction is
+// complete, every constant exists and the stack stays in bounds.
+static bool verifyChunk(Chunk* chunk) {
+    if (chunk->count == 0 || chunk->lineCount == 0 || chunk->lines[0].offset != 0) {
+        return false;
+    }
+    for (int i = 1; i < chunk->lineCount; i++) {
+        if (chunk->lines[i].offset <= chunk->lines[i - 1].offset ||
+            chunk->lines[i].offset >= chunk->count) {
+            return false;
+        }
+    }
+
+    // stack[0] is reserved for run()
+    int depth = 0;
+    for (int offset = 0; offset < chunk->count;) {
+        uint8_t op = chunk->code[offset];
+        int length = opcodeLength(op);
+        int pops, pushes;
+        if (offset + length > chunk->count ||
+            !instructionEffect(chunk, offset, &pops, &pushes) ||
+            depth < pops || depth + stackPeak(chunk, offset) > STACK_MAX - 1) {
+            return false;
+        }
+        depth += pushes - pops;
+
+        offset += length;
+        if (op == OP_RETURN) return offset == chunk->count;
+    }
+    return false;
+}
+
+static bool loadChunk(VM* vm, ChunkFile* file) {
+    const ChunkFileHeader* header = (const ChunkFileHeader*)file->mapping;
+    if (memcmp(header->magic, "LOXC", 4) != 0 ||
+        header->version != CHUNK_FILE_VERSION ||
+        header->optimizationLevel != (uint32_t)optimizationLevel ||
+        header->payloadLength != file->size - sizeof(ChunkFileHeader)) {
+        return false;
+    }
+
+    const uint8_t* payload = (const uint8_t*)file->mapping + sizeof(ChunkFileHeader);
+    const uint8_t* end = payload + header->payloadLength;
+    if (checksum(payload, header->payloadLength) != header->checksum) return false;
+
+    size_t linesSize = (size_t)header->lineCount * sizeof(LineStart);
+    if (header->lineCount > INT32_MAX || header->codeLength > INT32_MAX ||
+        linesSize + header->codeLength > header->payloadLength) {
+        return false;
+    }
+
+    // code and lines are used from the mapping, capacities stay 0 since the
+    // chunk doesn't own them
+    Chunk* chunk = &file->chunk;
+    chunk->lines = (LineStart*)payload;
+    chunk->lineCount = (int)header->lineCount;
+    chunk->code = (uint8_t*)payload + linesSize;
+    chunk->count = (int)header->codeLength;
+
+    const uint8_t* constants = chunk->code + chunk->count;
+    return readConstants(vm, chunk, constants, end, header->constantCount) && verifyChunk(chunk);
+}
+
+bool openChunkFile(VM* vm, const char* path, ChunkFile* file) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ChunkFileHeader) ||
+        (uint64_t)st.st_size > sizeof(ChunkFileHeader) + (uint64_t)UINT32_MAX) {
+        close(fd);
+        return false;
+    }
+    file->size = (size_t)st.st_size;
+    file->mapping = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file->mapping == MAP_FAILED) return false;
+
+    initChunk(&file->chunk);
+    if (!loadChunk(vm, file)) {
+        closeChunkFile(vm, file);
+        return false;
+    }
+    return true;
+}
+
+void closeChunkFile(VM* vm, ChunkFile* file) {
+    // code and lines belong to the mapping, only constants were allocated
+    freeValueArray(vm, &file->chunk.constants);
+    initChunk(&file->chunk);
+    munmap(file->mapping, file->size);
+    file->mapping = NULL;
+    file->size = 0;
+}
+
+void chunkFilePath(const char* sourcePath, char* buffer, size_t size) {
+    size_t length = strlen(sourcePath);
+    if (length >= 4 && strcmp(sourcePath + length - 4, ".lox") == 0) {
+        snprintf(buffer, size, "%sc", sourcePath);
+    } else {
+        snprintf(buffer, size, "%s.loxc", sourcePath);
+    }
+}
+
+bool chunkFileIsFresh(const char* sourcePath, const char* cachePath) {
+    struct stat source, cache;
+    if (stat(sourcePath, &source) != 0 || stat(cachePath, &cache) != 0) return false;
+    if (cache.st_mtim.tv_sec != source.st_mtim.tv_sec) {
+        return cache.st_mtim.tv_sec > source.st_mtim.tv_sec;
+    }
+    return cache.st_mtim.tv_nsec > source.st_mtim.tv_nsec;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include "chunk.h"
+
+// compiled chunks saved to .loxc files. a file is mapped read-only and its
+// code and line table are used in place, only constants are rebuilt.
+//
+// layout, in host byte order:
+//   ChunkFileHeader
+//   LineStart[lineCount]
+//   code[codeLength]
+//   constants: a tag byte each, then a double for numbers or a uint32
+//              length and the chars for strings
+
+// bump when the opcodes or the layout change, older files are then ignored
+#define CHUNK_FILE_VERSION 2
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t optimizationLevel;
+    uint32_t codeLength;
+    uint32_t lineCount;
+    uint32_t constantCount;
+    // bytes after the header
+    uint32_t payloadLength;
+    // FNV-1a of the payload
+    uint32_t checksum;
+} ChunkFileHeader;
+
+typedef struct {
+    Chunk chunk;
+    void* mapping;
+    size_t size;
+} ChunkFile;
+
+bool writeChunkFile(Chunk* chunk, const char* path);
+// false if the file is missing, was written by another version or fails
+// validation. the code is checked well enough that run() can't read past
+// the chunk, the constants or the stack.
+bool openChunkFile(VM* vm, const char* path, ChunkFile* file);
+void closeChunkFile(VM* vm, ChunkFile* file);
+// the cached chunk of the source at path, e.g. script.lox -> script.loxc
+void chunkFilePath(const char* sourcePath, char* buffer, size_t size);
+// true if the cache file was modified after the source
+bool chunkFileIsFresh(const char* sourcePath, const char* cachePath);
+
+#endif
\ No newline at end of file
@@ -1,39 +1,282 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
+#include "vm.h"
 
 
 void initChunk(Chunk* chunk) {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
     chunk->lines = NULL;
     initValueArray(&chunk->constants);
+    chunk->constantIndex = NULL;
+    chunk->constantIndexCount = 0;
+    chunk->constantIndexCapacity = 0;
 }
 
-void freeChunk(Chunk* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
-    freeValueArray(&chunk->constants);
+void freeChunk(VM* vm, Chunk* chunk) {
+    FREE_ARRAY(vm, uint8_t, chunk->code, chunk->capacity, MEM_CODE);
+    FREE_ARRAY(vm, LineStart, chunk->lines, chunk->lineCapacity, MEM_LINES);
+    freeValueArray(vm, &chunk->constants);
+    FREE_ARRAY(vm, int, chunk->constantIndex, chunk->constantIndexCapacity, MEM_CONSTANTS);
     initChunk(chunk);
 }
 
-void writeChunk(Chunk* chunk, uint8_t byte, int line) {
+void writeChunk(VM* vm, Chunk* chunk, uint8_t byte, int line) {
     if (chunk->capacity == chunk->count) {
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
-        chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);    
-        chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);    
+        chunk->code = GROW_ARRAY(vm, uint8_t, chunk->code, oldCapacity, chunk->capacity, MEM_CODE);    
     }
 
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
+
+    // still on the line of the last run
+    if (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].line == line) {
+        return;
+    }
+    if (chunk->lineCapacity == chunk->lineCount) {
+        int oldCapacity = chunk->lineCapacity;
+        chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->lines = GROW_ARRAY(vm, LineStart, chunk->lines, oldCapacity, chunk->lineCapacity, MEM_LINES);
+    }
+    LineStart* start = &chunk->lines[chunk->lineCount++];
+    start->offset = chunk->count - 1;
+    start->line = line;
+}
+
+void truncateChunk(Chunk* chunk, int count) {
+    chunk->count = count;
+    while (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].offset >= count) {
+        chunk->lineCount--;
+    }
+}
+
+int getLine(Chunk* chunk, int offset) {
+    // binary search the last run starting at or before offset
+    int low = 0;
+    int high = chunk->lineCount - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (chunk->lines[mid].offset <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return chunk->lines[low].line;
+}
+
+// constants are the same if they print the same, 0 and -0 are kept apart.
+// strings in the pool are interned, comparing pointers is enough.
+static bool sameConstant(Value a, Value b) {
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    if (IS_NUMBER(a) || IS_NUMBER(b)) return false;
+    if (IS_OBJ(a) && IS_OBJ(b)) return AS_OBJ(a) == AS_OBJ(b);
+    if (IS_BOOL(a) && IS_BOOL(b)) return AS_BOOL(a) == AS_BOOL(b);
+    return IS_NIL(a) && IS_NIL(b);
 }
 
-// return index of added constant
-int addConstant(Chunk* chunk, Value value) {
-    writeValueArray(&chunk->constants, value);
-    return chunk->constants.count - 1;
+static uint32_t hashConstant(Value value) {
+    uint64_t bits = 0;
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        memcpy(&bits, &number, sizeof(double));
+    } else if (IS_OBJ(value)) {
+        bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+    } else {
+        bits = IS_NIL(value) ? 1 : 2 + AS_BOOL(value);
+    }
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+#define EMPTY_SLOT -1
+// left behind by truncateConstants(), probing continues past it
+#define TOMBSTONE -2
+
+// slot of value in the index, or where to put it
+static int* findConstant(Chunk* chunk, Value value) {
+    int mask = chunk->constantIndexCapacity - 1;
+    uint32_t slot = hashConstant(value) & mask;
+    int* tombstone = NULL;
+    for (;;) {
+        int* entry = &chunk->constantIndex[slot];
+        if (*entry == EMPTY_SLOT) {
+            return tombstone != NULL ? tombstone : entry;
+        } else if (*entry == TOMBSTONE) {
+            if (tombstone == NULL) tombstone = entry;
+        } else if (sameConstant(chunk->constants.values[*entry], value)) {
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+// rebuild the index from the pool, dropping tombstones
+static void growConstantIndex(VM* vm, Chunk* chunk) {
+    FREE_ARRAY(vm, int, chunk->constantIndex, chunk->constantIndexCapacity, MEM_CONSTANTS);
+    chunk->constantIndexCapacity = chunk->constantIndexCapacity < 16 ? 16 : chunk->constantIndexCapacity * 2;
+    chunk->constantIndex = ALLOCATE_ARRAY(vm, int, chunk->constantIndexCapacity, MEM_CONSTANTS);
+    for (int i = 0; i < chunk->constantIndexCapacity; i++) {
+        chunk->constantIndex[i] = EMPTY_SLOT;
+    }
+
+    chunk->constantIndexCount = 0;
+    for (int i = 0; i < chunk->constants.count; i++) {
+        int* entry = findConstant(chunk, chunk->constants.values[i]);
+        if (*entry != EMPTY_SLOT) continue;
+        *entry = i;
+        chunk->constantIndexCount++;
+    }
 }
+
+int addConstant(VM* vm, Chunk* chunk, Value value) {
+    // growing the arrays can trigger a collection, keep value reachable
+    push(vm, value);
+    if ((chunk->constantIndexCount + 1) * 2 > chunk->constantIndexCapacity) {
+        growConstantIndex(vm, chunk);
+    }
+    int* entry = findConstant(chunk, value);
+    if (*entry < 0) {
+        // a tombstone is already counted
+        if (*entry == EMPTY_SLOT) chunk->constantIndexCount++;
+        writeValueArray(vm, &chunk->constants, value);
+        *entry = chunk->constants.count - 1;
+    }
+    pop(vm);
+    return *entry;
+}
+
+void truncateConstants(Chunk* chunk, int count) {
+    int mask = chunk->constantIndexCapacity - 1;
+    for (int i = count; i < chunk->constants.count && chunk->constantIndex != NULL; i++) {
+        uint32_t slot = hashConstant(chunk->constants.values[i]) & mask;
+        while (chunk->constantIndex[slot] != i && chunk->constantIndex[slot] != EMPTY_SLOT) {
+            slot = (slot + 1) & mask;
+        }
+        if (chunk->constantIndex[slot] == i) chunk->constantIndex[slot] = TOMBSTONE;
+    }
+    chunk->constants.count = count;
+}
+
+// copies with plain malloc(), no vm accounts for them
+static void* copyArray(const void* source, size_t size) {
+    if (size == 0) return NULL;
+    void* copy = malloc(size);
+    if (copy == NULL) exit(1);
+    memcpy(copy, source, size);
+    return copy;
+}
+
+Chunk* shareChunk(Chunk* chunk) {
+    Chunk* shared = (Chunk*)malloc(sizeof(Chunk));
+    if (shared == NULL) exit(1);
+    initChunk(shared);
+    shared->code = (uint8_t*)copyArray(chunk->code, chunk->count);
+    shared->count = shared->capacity = chunk->count;
+    shared->lines = (LineStart*)copyArray(chunk->lines, sizeof(LineStart) * chunk->lineCount);
+    shared->lineCount = shared->lineCapacity = chunk->lineCount;
+
+    ValueArray* constants = &shared->constants;
+    constants->values = (Value*)copyArray(chunk->constants.values, sizeof(Value) * chunk->constants.count);
+    constants->count = constants->capacity = chunk->constants.count;
+    for (int i = 0; i < constants->count; i++) {
+        // constants are never ropes, chars are there to copy
+        if (IS_STRING(constants->values[i])) {
+            ObjString* string = AS_STRING(constants->values[i]);
+            constants->values[i] = OBJ_VAL(newSharedString(string->chars, string->length));
+        }
+    }
+    return shared;
+}
+
+void freeSharedChunk(Chunk* chunk) {
+    for (int i = 0; i < chunk->constants.count; i++) {
+        if (IS_STRING(chunk->constants.values[i])) {
+            freeSharedString(AS_STRING(chunk->constants.values[i]));
+        }
+    }
+    free(chunk->code);
+    free(chunk->lines);
+    free(chunk->constants.values);
+    free(chunk);
+}
+
+int opcodeLength(uint8_t opcode) {
+    switch(opcode) {
+        case OP_CONSTANT:
+        case OP_ADD_CONST:
+        case OP_MULTIPLY_CONST:
+        case OP_ADD_N:
+        case OP_COLUMN:
+            return 2;
+        case OP_CONSTANT_LONG:
+            return 4;
+        default: return 1;
+    }
+}
+
+bool stackEffect(Chunk* chunk, int offset, int* pops, int* pushes) {
+    *pops = 0;
+    *pushes = 1;
+    switch(chunk->code[offset]) {
+        case OP_RETURN: *pops = 1; *pushes = 0; return true;
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NIL:
+        case OP_COLUMN:
+            return true;
+
+        case OP_NEGATE:
+        case OP_NOT:
+        case OP_ADD_CONST:
+        case OP_MULTIPLY_CONST:
+            *pops = 1;
+            return true;
+        // not implemented by the vm, they leave the stack alone
+        case OP_AND:
+        case OP_OR:
+            *pushes = 0;
+            return true;
+
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_EQUAL:
+        case OP_LESS:
+        case OP_GREATER:
+        case OP_NOT_EQUAL:
+        case OP_LESS_EQUAL:
+        case OP_GREATER_EQUAL:
+            *pops = 2;
+            return true;
+        case OP_ADD_N:
+            *pops = chunk->code[offset + 1];
+            return *pops >= 2;
+        default: return false;
+    }
+}
+
+int stackPeak(Chunk* chunk, int offset) {
+    if (chunk->code[offset] == OP_ADD_CONST) return 1;
+    int pops, pushes;
+    stackEffect(chunk, offset, &pops, &pushes);
+    return pushes > pops ? pushes - pops : 0;
+}
\ No newline at end of file
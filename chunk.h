@@ -8,6 +8,9 @@
 typedef enum {
     OP_RETURN,
     OP_CONSTANT,
+    // constant with a 24-bit index, low byte first. only used for constants
+    // past the first 256, OP_CONSTANT stays the common case.
+    OP_CONSTANT_LONG,
 
     OP_NEGATE,
     OP_ADD,
@@ -23,24 +26,86 @@ typedef enum {
     OP_AND,
     OP_OR,
 
-    // greater equal is translated to not less, same as less equal.
     OP_EQUAL,
     OP_LESS,
     OP_GREATER,
+
+    // superinstructions, each one does the work of a common opcode pair.
+    // not equal is equal + not.
+    OP_NOT_EQUAL,
+    // less equal is greater + not, greater equal is less + not,
+    // they keep the result of the pair when an operand is NaN.
+    OP_LESS_EQUAL,
+    OP_GREATER_EQUAL,
+    // constant + add/multiply, right operand is read from the constant pool.
+    OP_ADD_CONST,
+    OP_MULTIPLY_CONST,
+
+    // add the top <count> values left to right, e.g. a + b + c + d
+    OP_ADD_N,
+
+    // push the input column <index>, only compileColumns() emits it and only
+    // runColumns() runs it
+    OP_COLUMN,
 } OpCode;
 
+// a run of code on the same line, from offset up to the next run
+typedef struct {
+    int offset;
+    int line;
+} LineStart;
+
 // byte code chunk
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
-    int* lines;
+    // run-length encoded, one entry per line change instead of per byte
+    int lineCount;
+    int lineCapacity;
+    LineStart* lines;
     ValueArray constants;
+    // hash index over constants, finds an existing slot for a value.
+    // each entry is an index into constants, -1 when empty or -2 when the
+    // constant was truncated.
+    int* constantIndex;
+    int constantIndexCount;
+    int constantIndexCapacity;
 } Chunk;
 
+#define MAX_CONSTANTS (1 << 24)
+
 void initChunk(Chunk* chunk);
-void freeChunk(Chunk* chunk);
-void writeChunk(Chunk* chunk, uint8_t byte, int line);
-int addConstant(Chunk* chunk, Value value);
+void freeChunk(VM* vm, Chunk* chunk);
+void writeChunk(VM* vm, Chunk* chunk, uint8_t byte, int line);
+// drop the code from offset count on
+void truncateChunk(Chunk* chunk, int count);
+// line of the instruction at offset
+int getLine(Chunk* chunk, int offset);
+// return index of value in the constant pool, adding it if not there
+int addConstant(VM* vm, Chunk* chunk, Value value);
+// drop the constants from index count on
+void truncateConstants(Chunk* chunk, int count);
+// read-only copy of a compiled chunk that belongs to no vm, any number of
+// vms can run it at once, e.g. one per thread. string constants become
+// shared strings, see newSharedString(). free it with freeSharedChunk().
+Chunk* shareChunk(Chunk* chunk);
+void freeSharedChunk(Chunk* chunk);
+// number of bytes taken by an instruction, including its operands
+int opcodeLength(uint8_t opcode);
+
+// values the instruction at offset pops and pushes, false for an unknown
+// opcode or an OP_ADD_N of less than two values
+bool stackEffect(Chunk* chunk, int offset, int* pops, int* pushes);
+// most values the instruction at offset has on the stack above the ones it
+// starts with, while it runs. at least pushes - pops, OP_ADD_CONST pushes its
+// constant above its operand to concatenate strings.
+int stackPeak(Chunk* chunk, int offset);
+
+// 24-bit operand of OP_CONSTANT_LONG at offset
+static inline int readLong(Chunk* chunk, int offset) {
+    uint8_t* bytes = chunk->code + offset;
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16);
+}
 
 #endif
\ No newline at end of file
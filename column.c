@@ -0,0 +1,530 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "column.h"
+#include "object.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+////////////////////
+// Kernels
+///////////////////
+
+// each kernel handles n rows, out may be the same column as a.
+// the wide versions handle whole vectors and leave the tail to the scalar one.
+typedef struct {
+    void (*add)(double* out, const double* a, const double* b, int n);
+    void (*multiply)(double* out, const double* a, const double* b, int n);
+    // out[i] is a[i] < b[i], flipped if negate. NaN is never less.
+    void (*less)(bool* out, const double* a, const double* b, bool negate, int n);
+} KernelSet;
+
+static void addScalar(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+static void multiplyScalar(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] * b[i];
+}
+
+static void lessScalar(bool* out, const double* a, const double* b, bool negate, int n) {
+    for (int i = 0; i < n; i++) out[i] = (a[i] < b[i]) != negate;
+}
+
+#ifdef SIMD_X86
+
+static void addSSE2(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    addScalar(out + i, a + i, b + i, n - i);
+}
+
+static void multiplySSE2(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    multiplyScalar(out + i, a + i, b + i, n - i);
+}
+
+// cmplt is the ordered compare, false when either side is NaN
+static void lessSSE2(bool* out, const double* a, const double* b, bool negate, int n) {
+    int flip = negate ? 0x3 : 0;
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        int mask = _mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))) ^ flip;
+        out[i] = mask & 1;
+        out[i + 1] = mask >> 1;
+    }
+    lessScalar(out + i, a + i, b + i, negate, n - i);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static void addAVX2(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    addScalar(out + i, a + i, b + i, n - i);
+}
+
+AVX2 static void multiplyAVX2(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    multiplyScalar(out + i, a + i, b + i, n - i);
+}
+
+AVX2 static void lessAVX2(bool* out, const double* a, const double* b, bool negate, int n) {
+    int flip = negate ? 0xf : 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d less = _mm256_cmp_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _CMP_LT_OQ);
+        int mask = _mm256_movemask_pd(less) ^ flip;
+        out[i] = mask & 1;
+        out[i + 1] = (mask >> 1) & 1;
+        out[i + 2] = (mask >> 2) & 1;
+        out[i + 3] = mask >> 3;
+    }
+    lessScalar(out + i, a + i, b + i, negate, n - i);
+}
+
+#endif
+
+static const KernelSet scalarKernels = {addScalar, multiplyScalar, lessScalar};
+#ifdef SIMD_X86
+static const KernelSet sse2Kernels = {addSSE2, multiplySSE2, lessSSE2};
+static const KernelSet avx2Kernels = {addAVX2, multiplyAVX2, lessAVX2};
+#endif
+
+static KernelChoice kernelChoice = {.sets = {
+    [SIMD_SCALAR] = &scalarKernels,
+    #ifdef SIMD_X86
+    [SIMD_SSE2] = &sse2Kernels,
+    [SIMD_AVX2] = &avx2Kernels,
+    #endif
+}};
+
+bool useColumnKernels(ColumnKernels choice) {
+    return chooseKernels(&kernelChoice, (SimdLevel)choice);
+}
+
+////////////////////
+// Columns
+///////////////////
+
+// one stack slot over the rows of a block. a column where every row that
+// hasn't failed is a number keeps them unboxed in numbers, any other column
+// keeps its values, which are a root then.
+typedef struct {
+    bool isNumbers;
+    double numbers[COLUMN_BLOCK_ROWS];
+    Value values[COLUMN_BLOCK_ROWS];
+    ValueSpan* root;
+} Column;
+
+// state of one runColumns()
+typedef struct {
+    VM* vm;
+    Chunk* chunk;
+    const KernelSet* kernels;
+    // stack of columns, one more than the chunk needs for the constant of
+    // OP_ADD_CONST and OP_MULTIPLY_CONST
+    Column* slots;
+    // first row of the block and the rows in it
+    int first;
+    int rows;
+    // rows of the block that failed, later instructions skip them
+    bool failed[COLUMN_BLOCK_ROWS];
+    int failedCount;
+    // instruction being run, for errors
+    int offset;
+} Evaluation;
+
+static void failRow(Evaluation* evaluation, int row, const char* msg) {
+    int line = getLine(evaluation->chunk, evaluation->offset);
+    fprintf(evaluation->vm->err, "%s\n[line %d] in row %d\n", msg, line, evaluation->first + row);
+    evaluation->failed[row] = true;
+    evaluation->failedCount++;
+}
+
+static void setNumbers(Column* column) {
+    column->isNumbers = true;
+    column->root->count = 0;
+}
+
+static void setValues(Evaluation* evaluation, Column* column) {
+    column->isNumbers = false;
+    column->root->count = evaluation->rows;
+}
+
+// box the numbers, for instructions that work row by row
+static void toValues(Evaluation* evaluation, Column* column) {
+    if (!column->isNumbers) return;
+    for (int row = 0; row < evaluation->rows; row++) {
+        column->values[row] = NUMBER_VAL(column->numbers[row]);
+    }
+    setValues(evaluation, column);
+}
+
+// unbox a column that turned out to hold only numbers, so the instructions
+// after a row by row one can use the kernels again
+static void settle(Evaluation* evaluation, Column* column) {
+    if (column->isNumbers) return;
+    for (int row = 0; row < evaluation->rows; row++) {
+        if (!evaluation->failed[row] && !IS_NUMBER(column->values[row])) return;
+    }
+    for (int row = 0; row < evaluation->rows; row++) {
+        Value value = column->values[row];
+        column->numbers[row] = IS_NUMBER(value) ? AS_NUMBER(value) : 0;
+    }
+    setNumbers(column);
+}
+
+static void fill(Evaluation* evaluation, Column* column, Value value) {
+    if (IS_NUMBER(value)) {
+        for (int row = 0; row < evaluation->rows; row++) column->numbers[row] = AS_NUMBER(value);
+        setNumbers(column);
+    } else {
+        for (int row = 0; row < evaluation->rows; row++) column->values[row] = value;
+        setValues(evaluation, column);
+    }
+}
+
+static void fillBools(Evaluation* evaluation, Column* column, const bool* bools) {
+    for (int row = 0; row < evaluation->rows; row++) column->values[row] = BOOL_VAL(bools[row]);
+    setValues(evaluation, column);
+}
+
+static bool isFalsey(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+////////////////////
+// Instructions
+///////////////////
+
+static void readColumn(Evaluation* evaluation, Column* column, Value* input) {
+    memcpy(column->values, input + evaluation->first, sizeof(Value) * evaluation->rows);
+    setValues(evaluation, column);
+    settle(evaluation, column);
+}
+
+// a op b into a, op is OP_ADD, OP_SUBTRACT, OP_MULTIPLY or OP_DIVIDE
+static void arithmeticColumns(Evaluation* evaluation, uint8_t op, Column* a, Column* b) {
+    int rows = evaluation->rows;
+    if (a->isNumbers && b->isNumbers) {
+        switch(op) {
+            case OP_ADD: evaluation->kernels->add(a->numbers, a->numbers, b->numbers, rows); break;
+            case OP_MULTIPLY: evaluation->kernels->multiply(a->numbers, a->numbers, b->numbers, rows); break;
+            case OP_SUBTRACT:
+                for (int row = 0; row < rows; row++) a->numbers[row] -= b->numbers[row];
+                break;
+            case OP_DIVIDE:
+                for (int row = 0; row < rows; row++) a->numbers[row] /= b->numbers[row];
+                break;
+        }
+        return;
+    }
+
+    VM* vm = evaluation->vm;
+    toValues(evaluation, a);
+    toValues(evaluation, b);
+    for (int row = 0; row < rows; row++) {
+        if (evaluation->failed[row]) continue;
+        Value x = a->values[row];
+        Value y = b->values[row];
+        if (IS_NUMBER(x) && IS_NUMBER(y)) {
+            double left = AS_NUMBER(x);
+            double right = AS_NUMBER(y);
+            switch(op) {
+                case OP_ADD: a->values[row] = NUMBER_VAL(left + right); break;
+                case OP_SUBTRACT: a->values[row] = NUMBER_VAL(left - right); break;
+                case OP_MULTIPLY: a->values[row] = NUMBER_VAL(left * right); break;
+                case OP_DIVIDE: a->values[row] = NUMBER_VAL(left / right); break;
+            }
+        } else if (op == OP_ADD && IS_STRING(x) && IS_STRING(y)) {
+            // the operands stay reachable from the stack while it allocates
+            push(vm, x);
+            push(vm, y);
+            concatenate(vm);
+            a->values[row] = pop(vm);
+        } else if (op == OP_ADD) {
+            failRow(evaluation, row, "Operands of '+' must be number or string.");
+        } else {
+            failRow(evaluation, row, "Operands must be number.");
+        }
+    }
+    settle(evaluation, a);
+}
+
+// OP_ADD_N over count columns from operands on, the sum goes to the first.
+// rows are added left to right like run(), so the sums are the same.
+static void addColumns(Evaluation* evaluation, Column* operands, int count) {
+    bool numbers = true;
+    for (int i = 0; i < count; i++) numbers = numbers && operands[i].isNumbers;
+    if (numbers) {
+        for (int i = 1; i < count; i++) {
+            evaluation->kernels->add(operands[0].numbers, operands[0].numbers, operands[i].numbers, evaluation->rows);
+        }
+        return;
+    }
+
+    VM* vm = evaluation->vm;
+    for (int i = 0; i < count; i++) toValues(evaluation, &operands[i]);
+    for (int row = 0; row < evaluation->rows; row++) {
+        if (evaluation->failed[row]) continue;
+        bool strings = true;
+        for (int i = 0; i < count && strings; i++) strings = IS_STRING(operands[i].values[row]);
+        if (strings) {
+            for (int i = 0; i < count; i++) push(vm, operands[i].values[row]);
+            addN(vm, count);
+            operands[0].values[row] = pop(vm);
+            continue;
+        }
+
+        // anything else is added pairwise to report the error of addN()
+        Value sum = operands[0].values[row];
+        for (int i = 1; i < count; i++) {
+            Value operand = operands[i].values[row];
+            if (IS_NUMBER(sum) && IS_NUMBER(operand)) {
+                sum = NUMBER_VAL(AS_NUMBER(sum) + AS_NUMBER(operand));
+            } else if (IS_STRING(sum) && IS_STRING(operand)) {
+                push(vm, sum);
+                push(vm, operand);
+                concatenate(vm);
+                sum = pop(vm);
+            } else {
+                failRow(evaluation, row, "Operands of '+' must be number or string.");
+                break;
+            }
+        }
+        if (!evaluation->failed[row]) operands[0].values[row] = sum;
+    }
+    settle(evaluation, &operands[0]);
+}
+
+// a op b into a, op is one of the four ordered comparisons
+static void compareColumns(Evaluation* evaluation, uint8_t op, Column* a, Column* b) {
+    // a > b is b < a, a >= b is not a < b and a <= b is not b < a
+    bool negate = op == OP_LESS_EQUAL || op == OP_GREATER_EQUAL;
+    bool swap = op == OP_GREATER || op == OP_LESS_EQUAL;
+    Column* left = swap ? b : a;
+    Column* right = swap ? a : b;
+
+    bool result[COLUMN_BLOCK_ROWS];
+    if (a->isNumbers && b->isNumbers) {
+        evaluation->kernels->less(result, left->numbers, right->numbers, negate, evaluation->rows);
+    } else {
+        toValues(evaluation, a);
+        toValues(evaluation, b);
+        for (int row = 0; row < evaluation->rows; row++) {
+            result[row] = false;
+            if (evaluation->failed[row]) continue;
+            Value x = left->values[row];
+            Value y = right->values[row];
+            if (IS_NUMBER(x) && IS_NUMBER(y)) {
+                result[row] = (AS_NUMBER(x) < AS_NUMBER(y)) != negate;
+            } else {
+                failRow(evaluation, row, "Operands must be number.");
+            }
+        }
+    }
+    fillBools(evaluation, a, result);
+}
+
+static void equalColumns(Evaluation* evaluation, Column* a, Column* b, bool negate) {
+    bool result[COLUMN_BLOCK_ROWS];
+    if (a->isNumbers && b->isNumbers) {
+        for (int row = 0; row < evaluation->rows; row++) {
+            result[row] = (a->numbers[row] == b->numbers[row]) != negate;
+        }
+    } else {
+        toValues(evaluation, a);
+        toValues(evaluation, b);
+        for (int row = 0; row < evaluation->rows; row++) {
+            result[row] = false;
+            if (evaluation->failed[row]) continue;
+            result[row] = valueEqual(evaluation->vm, a->values[row], b->values[row]) != negate;
+        }
+    }
+    fillBools(evaluation, a, result);
+}
+
+static void negateColumn(Evaluation* evaluation, Column* a) {
+    if (a->isNumbers) {
+        for (int row = 0; row < evaluation->rows; row++) a->numbers[row] = -a->numbers[row];
+        return;
+    }
+    for (int row = 0; row < evaluation->rows; row++) {
+        if (evaluation->failed[row]) continue;
+        if (IS_NUMBER(a->values[row])) {
+            a->values[row] = NUMBER_VAL(-AS_NUMBER(a->values[row]));
+        } else {
+            failRow(evaluation, row, "Operand must be a number.");
+        }
+    }
+    settle(evaluation, a);
+}
+
+static void notColumn(Evaluation* evaluation, Column* a) {
+    bool result[COLUMN_BLOCK_ROWS];
+    for (int row = 0; row < evaluation->rows; row++) {
+        // numbers are never falsey
+        result[row] = !a->isNumbers && isFalsey(a->values[row]);
+    }
+    fillBools(evaluation, a, result);
+}
+
+static void writeResults(Evaluation* evaluation, Column* column, Value* results, bool* failed) {
+    Value* out = results + evaluation->first;
+    for (int row = 0; row < evaluation->rows; row++) {
+        if (evaluation->failed[row]) {
+            out[row] = NIL_VAL();
+        } else {
+            out[row] = column->isNumbers ? NUMBER_VAL(column->numbers[row]) : column->values[row];
+        }
+        if (failed != NULL) failed[evaluation->first + row] = evaluation->failed[row];
+    }
+}
+
+// run the chunk over the rows of one block
+static void runBlock(Evaluation* evaluation, Value** columns, Value* results, bool* failed) {
+    VM* vm = evaluation->vm;
+    Chunk* chunk = evaluation->chunk;
+    Value* constants = chunk->constants.values;
+    // one past the top column
+    Column* sp = evaluation->slots;
+
+    for (int offset = 0; offset < chunk->count; offset += opcodeLength(chunk->code[offset])) {
+        uint8_t op = chunk->code[offset];
+        evaluation->offset = offset;
+        vm->ip = chunk->code + offset + 1;
+        switch(op) {
+            case OP_RETURN: writeResults(evaluation, sp - 1, results, failed); return;
+            case OP_CONSTANT: fill(evaluation, sp++, constants[chunk->code[offset + 1]]); break;
+            case OP_CONSTANT_LONG: fill(evaluation, sp++, constants[readLong(chunk, offset + 1)]); break;
+            case OP_TRUE: fill(evaluation, sp++, BOOL_VAL(true)); break;
+            case OP_FALSE: fill(evaluation, sp++, BOOL_VAL(false)); break;
+            case OP_NIL: fill(evaluation, sp++, NIL_VAL()); break;
+            case OP_COLUMN: readColumn(evaluation, sp++, columns[chunk->code[offset + 1]]); break;
+
+            case OP_NEGATE: negateColumn(evaluation, sp - 1); break;
+            case OP_NOT: notColumn(evaluation, sp - 1); break;
+            // leave the stack alone like run()
+            case OP_AND:
+            case OP_OR:
+                break;
+
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+                arithmeticColumns(evaluation, op, sp - 2, sp - 1);
+                sp--;
+                break;
+            case OP_ADD_CONST:
+            case OP_MULTIPLY_CONST:
+                // the constant is a column of its own in the spare slot
+                fill(evaluation, sp, constants[chunk->code[offset + 1]]);
+                arithmeticColumns(evaluation, op == OP_ADD_CONST ? OP_ADD : OP_MULTIPLY, sp - 1, sp);
+                break;
+            case OP_ADD_N: {
+                int count = chunk->code[offset + 1];
+                addColumns(evaluation, sp - count, count);
+                sp -= count - 1;
+                break;
+            }
+
+            case OP_EQUAL: equalColumns(evaluation, sp - 2, sp - 1, false); sp--; break;
+            case OP_NOT_EQUAL: equalColumns(evaluation, sp - 2, sp - 1, true); sp--; break;
+            case OP_LESS:
+            case OP_GREATER:
+            case OP_LESS_EQUAL:
+            case OP_GREATER_EQUAL:
+                compareColumns(evaluation, op, sp - 2, sp - 1);
+                sp--;
+                break;
+        }
+    }
+}
+
+// deepest the stack gets, -1 if the chunk has an instruction runBlock()
+// doesn't know or reads a column past columnCount
+static int stackDepth(Chunk* chunk, int columnCount) {
+    int depth = 0;
+    int maxDepth = 0;
+    for (int offset = 0; offset < chunk->count; offset += opcodeLength(chunk->code[offset])) {
+        int pops, pushes;
+        if (!stackEffect(chunk, offset, &pops, &pushes)) return -1;
+        if (chunk->code[offset] == OP_COLUMN && chunk->code[offset + 1] >= columnCount) return -1;
+        depth += pushes - pops;
+        if (depth > maxDepth) maxDepth = depth;
+    }
+    return maxDepth;
+}
+
+////////////////////
+// Public methods
+///////////////////
+
+int runColumns(VM* vm, Chunk* chunk, Value** columns, int columnCount, int rowCount,
+               Value* results, bool* failed) {
+    int depth = stackDepth(chunk, columnCount);
+    if (depth < 0) return -1;
+
+    Evaluation evaluation;
+    evaluation.vm = vm;
+    evaluation.chunk = chunk;
+    evaluation.kernels = pickKernels(&kernelChoice);
+    evaluation.failedCount = 0;
+    evaluation.slots = (Column*)malloc(sizeof(Column) * (depth + 1));
+    if (evaluation.slots == NULL) exit(1);
+
+    // roots are the stack of columns, the input columns, the results written
+    // so far and whatever the caller had already made a root
+    ValueSpan* outerRoots = vm->roots;
+    int outerRootCount = vm->rootCount;
+    int rootCount = depth + 1 + columnCount + 1 + outerRootCount;
+    ValueSpan* roots = (ValueSpan*)malloc(sizeof(ValueSpan) * rootCount);
+    if (roots == NULL) exit(1);
+    for (int i = 0; i <= depth; i++) {
+        evaluation.slots[i].isNumbers = true;
+        evaluation.slots[i].root = &roots[i];
+        roots[i] = (ValueSpan){evaluation.slots[i].values, 0};
+    }
+    for (int i = 0; i < columnCount; i++) {
+        roots[depth + 1 + i] = (ValueSpan){columns[i], rowCount};
+    }
+    ValueSpan* written = &roots[depth + 1 + columnCount];
+    *written = (ValueSpan){results, 0};
+    if (outerRootCount > 0) memcpy(written + 1, outerRoots, sizeof(ValueSpan) * outerRootCount);
+
+    vm->roots = roots;
+    vm->rootCount = rootCount;
+    // the collector marks the constants through vm->chunk
+    vm->chunk = chunk;
+    vm->stackTop = STACK_BASE(vm);
+
+    for (int first = 0; first < rowCount; first += COLUMN_BLOCK_ROWS) {
+        evaluation.first = first;
+        evaluation.rows = rowCount - first < COLUMN_BLOCK_ROWS ? rowCount - first : COLUMN_BLOCK_ROWS;
+        memset(evaluation.failed, 0, sizeof(evaluation.failed));
+        runBlock(&evaluation, columns, results, failed);
+        written->count = first + evaluation.rows;
+    }
+
+    vm->chunk = NULL;
+    vm->roots = outerRoots;
+    vm->rootCount = outerRootCount;
+    free(roots);
+    free(evaluation.slots);
+    return evaluation.failedCount;
+}
\ No newline at end of file
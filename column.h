@@ -0,0 +1,40 @@
+#ifndef clox_column_h
+#define clox_column_h
+
+#include "simd.h"
+#include "vm.h"
+
+// columnar evaluation of one expression over many rows. the chunk is
+// compiled once by compileColumns() and run over blocks of COLUMN_BLOCK_ROWS
+// rows, every instruction works on a whole column with one value per row of
+// the block, so dispatch costs once per block instead of once per row.
+//
+// columns of numbers are kept unboxed and go through loops that handle 2 or
+// 4 rows at once on x86-64. anything else is evaluated row by row with the
+// results and errors of run(), a row that fails doesn't stop the others.
+
+#define COLUMN_BLOCK_ROWS 256
+
+// loops over columns of numbers, the widest the cpu supports is used
+typedef enum {
+    COLUMN_SCALAR = SIMD_SCALAR,
+    COLUMN_SSE2 = SIMD_SSE2,
+    COLUMN_AVX2 = SIMD_AVX2,
+} ColumnKernels;
+
+// override the kernels of runColumns() calls started after it, false if the
+// cpu doesn't support them. call it before runColumns() runs on other threads.
+bool useColumnKernels(ColumnKernels kernels);
+
+// evaluate chunk over rowCount rows, columns[i] holds the values of input
+// column i for every row and the result of row r goes to results[r].
+// a row that fails prints its error to vm->err, gets nil and failed[r] set,
+// failed may be NULL. returns the number of failed rows, or -1 if chunk reads
+// a column past columnCount or isn't a chunk runColumns() can run.
+//
+// collections during the call move young strings of columns in place.
+// results are not roots once it returns, use them before allocating on vm.
+int runColumns(VM* vm, Chunk* chunk, Value** columns, int columnCount, int rowCount,
+               Value* results, bool* failed);
+
+#endif
\ No newline at end of file
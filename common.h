@@ -5,4 +5,14 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// store Value as a NaN-boxed 64-bit word instead of a tagged union,
+// can also be turned on from the command line with -DNAN_BOXING.
+// #define NAN_BOXING
+
+// dispatch opcodes through a table of label addresses (labels-as-values) on
+// GCC/Clang, -DDISPATCH_SWITCH forces the portable switch loop.
+#if defined(__GNUC__) && !defined(DISPATCH_SWITCH)
+#define THREADED_DISPATCH
+#endif
+
 #endif
\ No newline at end of file
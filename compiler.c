@@ -1,9 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "compiler.h"
 #include "common.h"
 #include "debug.h"
 #include "object.h"
+#include "memory.h"
+#include "optimizer.h"
 
 #include "scanner.h"
 
@@ -33,7 +36,7 @@ typedef enum {
 } Precedence;
 
 // function pointer type
-typedef void (*ParseFn)();
+typedef void (*ParseFn)(Compiler* compiler);
 
 typedef struct {
     ParseFn prefix;
@@ -41,54 +44,73 @@ typedef struct {
     Precedence precedence;
 } ParseRule;
 
-Parser parser;
-Chunk* compilingChunk;
+// where an operand's code and constants begin in the chunk
+typedef struct {
+    int code;
+    int constants;
+} OperandStart;
+
+// state of one compile(), every compile has its own
+struct Compiler {
+    VM* vm;
+    Scanner scanner;
+    Parser parser;
+    Chunk* chunk;
+    // start of the left operand of the infix rule being parsed
+    OperandStart leftOperand;
+    // names of the input columns of compileColumns(), NULL for compile()
+    const char* const* columns;
+    int columnCount;
+};
+
+int optimizationLevel = 1;
+bool borrowLiterals = false;
 
 ////////////////////
 // Read token
 ///////////////////
 
 // report error on token
-static void errorAt(const char* msg, Token* token) {
-    if (parser.panicMode) {
+static void errorAt(Compiler* compiler, const char* msg, Token* token) {
+    if (compiler->parser.panicMode) {
         // ignore errors in panic mode
         return;
     }
 
     // print error msg
-    fprintf(stderr, "[line %d] Error", token->line);
+    fprintf(compiler->vm->err, "[line %d] Error", token->line);
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(compiler->vm->err, " at end");
     } else if (token->type == TOKEN_ERROR) {
         // nothing
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(compiler->vm->err, " at '%.*s'", token->length, token->start);
     }
-    fprintf(stderr, ": %s\n", msg);
+    fprintf(compiler->vm->err, ": %s\n", msg);
     
 
-    parser.hadError = true;
+    compiler->parser.hadError = true;
     // when found an error, enter panic mode, skip following tokens until reaches recovery point.
-    parser.panicMode = true;
+    compiler->parser.panicMode = true;
 }
 
-static void errorAtCurrent(const char* msg) {
-    errorAt(msg, &parser.current);
+static void errorAtCurrent(Compiler* compiler, const char* msg) {
+    errorAt(compiler, msg, &compiler->parser.current);
 }
 
-static void error(const char* msg) {
-    errorAt(msg, &parser.previous);
+static void error(Compiler* compiler, const char* msg) {
+    errorAt(compiler, msg, &compiler->parser.previous);
 }
 
 // read one valid token
-static void advance() {
-    parser.previous = parser.current;
+static void advance(Compiler* compiler) {
+    compiler->parser.previous = compiler->parser.current;
 
     for (;;) {
-        parser.current = scanToken();
-        if (parser.current.type == TOKEN_ERROR) {
+        compiler->parser.current = scanToken(&compiler->scanner);
+        if (compiler->parser.current.type == TOKEN_ERROR) {
             // the token points to error message
-            errorAtCurrent(parser.current.start);
+            errorAtCurrent(compiler, compiler->parser.current.start);
         } else {
             // valid token, stop loopping
             break;
@@ -97,11 +119,11 @@ static void advance() {
 }
 
 // match a token type and advance, otherwise fail
-static void consume(TokenType type, const char* msg) {
-    if (parser.current.type == type) {
-        advance();
+static void consume(Compiler* compiler, TokenType type, const char* msg) {
+    if (compiler->parser.current.type == type) {
+        advance(compiler);
     } else {
-        errorAtCurrent(msg);
+        errorAtCurrent(compiler, msg);
     }
 }
 
@@ -109,44 +131,208 @@ static void consume(TokenType type, const char* msg) {
 // Emit bytecode
 ///////////////////
 
-static Chunk* currentChunk() {
-    return compilingChunk;
+static Chunk* currentChunk(Compiler* compiler) {
+    return compiler->chunk;
 }
 
-static void emitByte(uint8_t byte) {
-    writeChunk(currentChunk(), byte, parser.previous.line);
+static void emitByte(Compiler* compiler, uint8_t byte) {
+    writeChunk(compiler->vm, currentChunk(compiler), byte, compiler->parser.previous.line);
 }
 
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
-    emitByte(byte1);
-    emitByte(byte2);
+static void emitBytes(Compiler* compiler, uint8_t byte1, uint8_t byte2) {
+    emitByte(compiler, byte1);
+    emitByte(compiler, byte2);
 }
 
-static void emitReturn() {
-    emitByte(OP_RETURN);
+static void emitReturn(Compiler* compiler) {
+    emitByte(compiler, OP_RETURN);
 }
 
 // constant stored in an array in chunk, return index of constant
-static uint8_t makeConstant(Value value) {
-    int constant = addConstant(currentChunk(), value);
-    if (constant > UINT8_MAX) {
-        error("Too many constants in one chunk.");
+static int makeConstant(Compiler* compiler, Value value) {
+    int constant = addConstant(compiler->vm, currentChunk(compiler), value);
+    if (constant >= MAX_CONSTANTS) {
+        error(compiler, "Too many constants in one chunk.");
         return 0;
     }
-    return (uint8_t)constant;
+    return constant;
+}
+
+static void emitConstant(Compiler* compiler, Value value) {
+    int constant = makeConstant(compiler, value);
+    if (constant <= UINT8_MAX) {
+        emitBytes(compiler, OP_CONSTANT, (uint8_t)constant);
+    } else {
+        emitByte(compiler, OP_CONSTANT_LONG);
+        emitBytes(compiler, (uint8_t)constant, (uint8_t)(constant >> 8));
+        emitByte(compiler, (uint8_t)(constant >> 16));
+    }
+}
+
+// emit value as the cheapest instruction that produces it
+static void emitValue(Compiler* compiler, Value value) {
+    if (IS_NIL(value)) {
+        emitByte(compiler, OP_NIL);
+    } else if (IS_BOOL(value)) {
+        emitByte(compiler, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        emitConstant(compiler, value);
+    }
 }
 
-static void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+// code is straight-line, the deepest the stack gets is known up front
+static int maxStackDepth(Chunk* chunk) {
+    int depth = 0;
+    int max = 0;
+    for (int offset = 0; offset < chunk->count; offset += opcodeLength(chunk->code[offset])) {
+        int pops, pushes;
+        stackEffect(chunk, offset, &pops, &pushes);
+        int peak = depth + stackPeak(chunk, offset);
+        if (peak > max) max = peak;
+        depth += pushes - pops;
+    }
+    return max;
 }
 
-static void endCompiler() {
-    emitReturn();
+static void endCompiler(Compiler* compiler) {
+    emitReturn(compiler);
     #ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) {
-        disassembleChunk(currentChunk(), "code");
+    if (!compiler->parser.hadError) {
+        disassembleChunk(compiler->vm, currentChunk(compiler), "code");
     }
     #endif
+
+    if (compiler->parser.hadError) return;
+    if (optimizationLevel >= 1) {
+        // constants of the chunk are still rooted by markCompilerRoots
+        optimizeChunk(compiler->vm, currentChunk(compiler));
+        #ifdef DEBUG_PRINT_CODE
+        disassembleChunk(compiler->vm, currentChunk(compiler), "optimized");
+        #endif
+    }
+    // stack[0] is reserved for run()
+    if (maxStackDepth(currentChunk(compiler)) > STACK_MAX - 1) {
+        error(compiler, "Expression too complex.");
+    }
+}
+
+////////////////////
+// Constant folding
+///////////////////
+
+static OperandStart markOperand(Compiler* compiler) {
+    OperandStart start;
+    start.code = currentChunk(compiler)->count;
+    start.constants = currentChunk(compiler)->constants.count;
+    return start;
+}
+
+// drop the code and constants emitted since start
+static void rewindTo(Compiler* compiler, OperandStart start) {
+    truncateChunk(currentChunk(compiler), start.code);
+    truncateConstants(currentChunk(compiler), start.constants);
+}
+
+// true if code in [start, end) is a single instruction pushing a constant
+static bool constantOperand(Compiler* compiler, int start, int end, Value* value) {
+    Chunk* chunk = currentChunk(compiler);
+    if (start >= end || end - start != opcodeLength(chunk->code[start])) {
+        return false;
+    }
+    switch(chunk->code[start]) {
+        case OP_CONSTANT: *value = chunk->constants.values[chunk->code[start+1]]; return true;
+        case OP_CONSTANT_LONG: *value = chunk->constants.values[readLong(chunk, start+1)]; return true;
+        case OP_TRUE: *value = BOOL_VAL(true); return true;
+        case OP_FALSE: *value = BOOL_VAL(false); return true;
+        case OP_NIL: *value = NIL_VAL(); return true;
+        default: return false;
+    }
+}
+
+// constants are created in the old space, see collectNursery.
+// a and b are still in the constant table, so they survive a collection here.
+static Value concatConstants(Compiler* compiler, ObjString* a, ObjString* b) {
+    int length = a->length + b->length;
+    char* chars = ALLOCATE_ARRAY(compiler->vm, char, length+1, MEM_STRING_CHARS); // allocate
+    memcpy(chars, a->chars, a->length);
+    memcpy(chars + a->length, b->chars, b->length);
+    chars[length] = '\0';
+    return OBJ_VAL(takeString(compiler->vm, chars, length));
+}
+
+#define FOLD_STRING_MAX 4096
+
+// folding mirrors the vm: an operation that would raise a runtime error is
+// left in the code, so the error still happens when it runs.
+static bool foldUnary(TokenType operator, Value value, Value* result) {
+    switch(operator) {
+        case TOKEN_MINUS:
+            if (!IS_NUMBER(value)) return false;
+            *result = NUMBER_VAL(-AS_NUMBER(value));
+            return true;
+        case TOKEN_BANG:
+            *result = BOOL_VAL(IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)));
+            return true;
+        default: return false;
+    }
+}
+
+static bool foldBinary(Compiler* compiler, TokenType operator, Value a, Value b, Value* result) {
+    switch(operator) {
+        case TOKEN_PLUS:
+            if (IS_STRING(a) && IS_STRING(b)) {
+                // a chain is folded one operand at a time, copying the prefix
+                // each step. past this length OP_ADD_N is left to do it once.
+                if (AS_STRING(a)->length + AS_STRING(b)->length > FOLD_STRING_MAX) return false;
+                *result = concatConstants(compiler, AS_STRING(a), AS_STRING(b));
+                return true;
+            }
+            break;
+        case TOKEN_EQUAL_EQUAL: *result = BOOL_VAL(valueEqual(compiler->vm, a, b)); return true;
+        case TOKEN_BANG_EQUAL: *result = BOOL_VAL(!valueEqual(compiler->vm, a, b)); return true;
+        case TOKEN_MINUS:
+        case TOKEN_STAR:
+        case TOKEN_SLASH:
+        case TOKEN_LESS:
+        case TOKEN_GREATER:
+        case TOKEN_LESS_EQUAL:
+        case TOKEN_GREATER_EQUAL:
+            break;
+        // and, or are not implemented by the vm yet
+        default: return false;
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    switch(operator) {
+        case TOKEN_PLUS: *result = NUMBER_VAL(x + y); break;
+        case TOKEN_MINUS: *result = NUMBER_VAL(x - y); break;
+        case TOKEN_STAR: *result = NUMBER_VAL(x * y); break;
+        case TOKEN_SLASH: *result = NUMBER_VAL(x / y); break;
+        case TOKEN_LESS: *result = BOOL_VAL(x < y); break;
+        case TOKEN_GREATER: *result = BOOL_VAL(x > y); break;
+        // same as OP_LESS_EQUAL and OP_GREATER_EQUAL, matters for NaN
+        case TOKEN_LESS_EQUAL: *result = BOOL_VAL(!(x > y)); break;
+        case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); break;
+        default: return false;
+    }
+    return true;
+}
+
+// if both operands are constants and the operation can't fail, replace
+// their code with the result.
+static bool foldOperands(Compiler* compiler, TokenType operator, OperandStart left, OperandStart right) {
+    Value a, b, result;
+    if (optimizationLevel < 1 ||
+        !constantOperand(compiler, left.code, right.code, &a) ||
+        !constantOperand(compiler, right.code, currentChunk(compiler)->count, &b) ||
+        !foldBinary(compiler, operator, a, b, &result)) {
+        return false;
+    }
+    rewindTo(compiler, left);
+    emitValue(compiler, result);
+    return true;
 }
 
 ////////////////////
@@ -156,96 +342,290 @@ static void endCompiler() {
 static ParseRule* getRule(TokenType type);
 
 // parse expression at given precedence or higher
-static void parsePrecedence(Precedence precedence) {
-    advance();
+static void parsePrecedence(Compiler* compiler, Precedence precedence) {
+    advance(compiler);
 
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+    ParseFn prefixRule = getRule(compiler->parser.previous.type)->prefix;
     if (prefixRule == NULL) {
-        error("Expect expression.");
+        error(compiler, "Expect expression.");
         return;
     }
-    prefixRule();
+    OperandStart start = markOperand(compiler);
+    prefixRule(compiler);
 
     // execute rules with precedence same or higher than we specified.
     // while loop handles a chains of operators, e.g. 1+1+1+1
     // this algorithm is called Pratt Parsing.
-    while (precedence <= getRule(parser.current.type)->precedence) {
-        advance();
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule();
+    while (precedence <= getRule(compiler->parser.current.type)->precedence) {
+        advance(compiler);
+        ParseFn infixRule = getRule(compiler->parser.previous.type)->infix;
+        // everything parsed so far is the left operand
+        compiler->leftOperand = start;
+        infixRule(compiler);
     }
 }
 
-static void expression() {
+static void expression(Compiler* compiler) {
     // parse everything
-    parsePrecedence(PREC_ASSIGNMENT);
+    parsePrecedence(compiler, PREC_ASSIGNMENT);
 }
 
-static void number() {
-    double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+static void number(Compiler* compiler) {
+    double value = strtod(compiler->parser.previous.start, NULL);
+    emitConstant(compiler, NUMBER_VAL(value));
 }
 
 // assumption for all compiling function is that the initial token is already
 // consumed.
-static void grouping() {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+static void grouping(Compiler* compiler) {
+    expression(compiler);
+    consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
 // operator emits after operand, we use stack-based bytecode.
-static void unary() {
-    TokenType operator = parser.previous.type;
+static void unary(Compiler* compiler) {
+    TokenType operator = compiler->parser.previous.type;
+    OperandStart start = markOperand(compiler);
     // operand
     // also use unary here to support nested unary operator.
-    parsePrecedence(PREC_UNARY);
+    parsePrecedence(compiler, PREC_UNARY);
+
+    Value value;
+    if (optimizationLevel >= 1 &&
+        constantOperand(compiler, start.code, currentChunk(compiler)->count, &value) &&
+        foldUnary(operator, value, &value)) {
+        rewindTo(compiler, start);
+        emitValue(compiler, value);
+        return;
+    }
 
     switch(operator) {
-        case TOKEN_MINUS: emitByte(OP_NEGATE); break;
-        case TOKEN_BANG: emitByte(OP_NOT); break;
+        case TOKEN_MINUS: emitByte(compiler, OP_NEGATE); break;
+        case TOKEN_BANG: emitByte(compiler, OP_NOT); break;
         default: return;
     }
 }
 
-static void binary() {
-    TokenType operator = parser.previous.type;
+// if the right operand compiled to a single OP_CONSTANT, turn it into the
+// fused form of the operator, e.g. OP_CONSTANT + OP_ADD -> OP_ADD_CONST.
+static bool fuseConstant(Compiler* compiler, int operandStart, OpCode fused) {
+    Chunk* chunk = currentChunk(compiler);
+    if (chunk->count != operandStart + 2 || chunk->code[operandStart] != OP_CONSTANT) {
+        return false;
+    }
+    chunk->code[operandStart] = fused;
+    return true;
+}
+
+// operands added by one OP_ADD_N, a longer chain is split. operands wait on
+// the stack, keep room for the ones that need stack space themselves.
+#define ADD_N_MAX 128
+
+// what an operand's code is known to leave on the stack
+typedef enum {
+    KNOWN_NUMBER,
+    KNOWN_STRING,
+    // nil, a bool, or a column that can hold anything
+    KNOWN_OTHER,
+} KnownType;
+
+static KnownType knownConstant(Value value) {
+    if (IS_NUMBER(value)) return KNOWN_NUMBER;
+    if (IS_STRING(value)) return KNOWN_STRING;
+    return KNOWN_OTHER;
+}
+
+// true if the code from start to the end of the chunk can't raise a runtime
+// error: constants, columns, and + of only numbers or only strings.
+// anything else is assumed to fail.
+static bool cannotFail(Compiler* compiler, int start) {
+    Chunk* chunk = currentChunk(compiler);
+    KnownType stack[STACK_MAX];
+    int depth = 0;
+    for (int offset = start; offset < chunk->count; offset += opcodeLength(chunk->code[offset])) {
+        int pops, pushes;
+        if (!stackEffect(chunk, offset, &pops, &pushes) || depth + pushes - pops >= STACK_MAX) {
+            return false;
+        }
+        switch(chunk->code[offset]) {
+            case OP_CONSTANT:
+                stack[depth++] = knownConstant(chunk->constants.values[chunk->code[offset + 1]]);
+                break;
+            case OP_CONSTANT_LONG:
+                stack[depth++] = knownConstant(chunk->constants.values[readLong(chunk, offset + 1)]);
+                break;
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_NIL:
+            case OP_COLUMN:
+                stack[depth++] = KNOWN_OTHER;
+                break;
+            case OP_ADD_CONST:
+                if (depth < 1) return false;
+                stack[depth++] = knownConstant(chunk->constants.values[chunk->code[offset + 1]]);
+                // fall through, the constant is the right operand
+            case OP_ADD:
+            case OP_ADD_N: {
+                int count = chunk->code[offset] == OP_ADD_N ? chunk->code[offset + 1] : 2;
+                if (depth < count) return false;
+                depth -= count;
+                for (int i = 1; i < count; i++) {
+                    if (stack[depth + i] != stack[depth] || stack[depth] == KNOWN_OTHER) return false;
+                }
+                depth++;
+                break;
+            }
+            default: return false;
+        }
+    }
+    return true;
+}
+
+// instruction that adds the top operands of a chain, lastStart is where the
+// last one starts
+static void emitSum(Compiler* compiler, int operands, int lastStart, int line) {
+    Chunk* chunk = currentChunk(compiler);
+    if (operands == 2) {
+        if (!fuseConstant(compiler, lastStart, OP_ADD_CONST)) writeChunk(compiler->vm, chunk, OP_ADD, line);
+    } else if (operands > 2) {
+        writeChunk(compiler->vm, chunk, OP_ADD_N, line);
+        writeChunk(compiler->vm, chunk, operands, line);
+    }
+}
+
+// move the code of the operand at start behind the sum of the operands below
+// it, so their + runs first. code has no jumps, it runs the same anywhere.
+// returns where the operand starts now.
+static int sumBefore(Compiler* compiler, int operands, int lastStart, int line, int start) {
+    Chunk* chunk = currentChunk(compiler);
+    int length = chunk->count - start;
+    uint8_t* code = (uint8_t*)malloc(length);
+    int* lines = (int*)malloc(sizeof(int) * length);
+    if (code == NULL || lines == NULL) exit(1);
+    for (int i = 0; i < length; i++) {
+        code[i] = chunk->code[start + i];
+        lines[i] = getLine(chunk, start + i);
+    }
+
+    truncateChunk(chunk, start);
+    emitSum(compiler, operands, lastStart, line);
+    start = chunk->count;
+    for (int i = 0; i < length; i++) writeChunk(compiler->vm, chunk, code[i], lines[i]);
+    free(code);
+    free(lines);
+    return start;
+}
+
+// a chain of + is left-associative, a + b + c + d is ((a + b) + c) + d.
+// runs of operands are compiled first, then a single OP_ADD_N adds them,
+// strings are concatenated without building intermediate results.
+// a run only takes operands that can't fail and whose + are on one line,
+// the first + that fails and its line are the ones of pairwise OP_ADD.
+static void addition(Compiler* compiler, OperandStart left) {
+    // left operand is already compiled
+    int operands = 1;
+    int lastStart = 0;
+    // line of the + in the run, OP_ADD would get the line its right operand ends on
+    int line = 0;
+    for (;;) {
+        OperandStart right = markOperand(compiler);
+        parsePrecedence(compiler, (Precedence)(PREC_ADD_TERM+1));
+        // fold while the chain so far is a single constant, "a" + "b" + x
+        // becomes "ab" + x. x + "a" + "b" is (x + "a") + "b", nothing to fold.
+        if (operands == 1 && foldOperands(compiler, TOKEN_PLUS, left, right)) {
+            if (compiler->parser.current.type != TOKEN_PLUS) break;
+            advance(compiler);
+            continue;
+        }
+
+        int start = right.code;
+        int operandLine = compiler->parser.previous.line;
+        if (operands > 1 && (operandLine != line || !cannotFail(compiler, start))) {
+            // the sum so far is the left operand of the rest of the chain
+            start = sumBefore(compiler, operands, lastStart, line, start);
+            operands = 1;
+        }
+        if (operands == 1) line = operandLine;
+        operands++;
+        lastStart = start;
+        if (operands == ADD_N_MAX) {
+            // the sum so far is the left operand of the next run
+            emitSum(compiler, operands, lastStart, line);
+            operands = 1;
+        }
+
+        if (compiler->parser.current.type != TOKEN_PLUS) break;
+        advance(compiler);
+    }
+    emitSum(compiler, operands, lastStart, line);
+}
+
+static void binary(Compiler* compiler) {
+    TokenType operator = compiler->parser.previous.type;
+    OperandStart left = compiler->leftOperand;
+    if (operator == TOKEN_PLUS) {
+        addition(compiler, left);
+        return;
+    }
+
     ParseRule* rule = getRule(operator);
-    parsePrecedence((Precedence)(rule->precedence+1));
+    OperandStart right = markOperand(compiler);
+    parsePrecedence(compiler, (Precedence)(rule->precedence+1));
+    if (foldOperands(compiler, operator, left, right)) return;
     switch(operator) {
-        case TOKEN_PLUS: emitByte(OP_ADD); break;
-        case TOKEN_MINUS: emitByte(OP_SUBTRACT); break;
-        case TOKEN_STAR: emitByte(OP_MULTIPLY); break;
-        case TOKEN_SLASH: emitByte(OP_DIVIDE); break;
-
-        case TOKEN_AND: emitByte(OP_AND); break;
-        case TOKEN_OR: emitByte(OP_OR); break;
-
-        case TOKEN_EQUAL_EQUAL: emitByte(OP_EQUAL); break;
-        case TOKEN_BANG_EQUAL: emitBytes(OP_EQUAL, OP_NOT); break;
-        case TOKEN_LESS: emitByte(OP_LESS); break;
-        case TOKEN_GREATER: emitByte(OP_GREATER); break;
-        // convert less equal to not greater
-        case TOKEN_LESS_EQUAL: emitBytes(OP_GREATER, OP_NOT); break;
-        case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT); break;
+        case TOKEN_MINUS: emitByte(compiler, OP_SUBTRACT); break;
+        case TOKEN_STAR:
+            if (!fuseConstant(compiler, right.code, OP_MULTIPLY_CONST)) emitByte(compiler, OP_MULTIPLY);
+            break;
+        case TOKEN_SLASH: emitByte(compiler, OP_DIVIDE); break;
+
+        case TOKEN_AND: emitByte(compiler, OP_AND); break;
+        case TOKEN_OR: emitByte(compiler, OP_OR); break;
+
+        case TOKEN_EQUAL_EQUAL: emitByte(compiler, OP_EQUAL); break;
+        case TOKEN_BANG_EQUAL: emitByte(compiler, OP_NOT_EQUAL); break;
+        case TOKEN_LESS: emitByte(compiler, OP_LESS); break;
+        case TOKEN_GREATER: emitByte(compiler, OP_GREATER); break;
+        // less equal is not greater, greater equal is not less.
+        case TOKEN_LESS_EQUAL: emitByte(compiler, OP_LESS_EQUAL); break;
+        case TOKEN_GREATER_EQUAL: emitByte(compiler, OP_GREATER_EQUAL); break;
         default: return;
     }
 }
 
-static void literal() {
-    TokenType type = parser.previous.type;
+static void literal(Compiler* compiler) {
+    TokenType type = compiler->parser.previous.type;
     switch(type) {
-        case TOKEN_TRUE: emitByte(OP_TRUE); break;
-        case TOKEN_FALSE: emitByte(OP_FALSE); break;
-        case TOKEN_NIL: emitByte(OP_NIL); break;
+        case TOKEN_TRUE: emitByte(compiler, OP_TRUE); break;
+        case TOKEN_FALSE: emitByte(compiler, OP_FALSE); break;
+        case TOKEN_NIL: emitByte(compiler, OP_NIL); break;
         default: return;
     }
 }
 
-static void string() {
-    // copy string 
-    ObjString* str = copyString(parser.previous.start+1, parser.previous.length-2);
+static void string(Compiler* compiler) {
+    const char* start = compiler->parser.previous.start+1;
+    int length = compiler->parser.previous.length-2;
+    ObjString* str = borrowLiterals ? borrowString(compiler->vm, start, length) : copyString(compiler->vm, start, length);
 
-    emitConstant(OBJ_VAL(str));
+    emitConstant(compiler, OBJ_VAL(str));
+}
+
+// an identifier names an input column, there are no variables yet
+static void column(Compiler* compiler) {
+    if (compiler->columns == NULL) {
+        error(compiler, "Expect expression.");
+        return;
+    }
+    Token* name = &compiler->parser.previous;
+    for (int i = 0; i < compiler->columnCount; i++) {
+        const char* candidate = compiler->columns[i];
+        if ((int)strlen(candidate) == name->length && memcmp(candidate, name->start, name->length) == 0) {
+            emitBytes(compiler, OP_COLUMN, (uint8_t)i);
+            return;
+        }
+    }
+    error(compiler, "Unknown column.");
 }
 
 ParseRule rules[] = {
@@ -268,7 +648,7 @@ ParseRule rules[] = {
     [TOKEN_GREATER_EQUAL] = {NULL, binary, PREC_COMP},
     [TOKEN_LESS] = 	        {NULL, binary, PREC_COMP},
     [TOKEN_LESS_EQUAL] = 	{NULL, binary, PREC_COMP},
-    [TOKEN_IDENTIFIER] = 	{NULL, NULL, PREC_NONE},
+    [TOKEN_IDENTIFIER] = 	{column, NULL, PREC_NONE},
     [TOKEN_STRING] = 	    {string, NULL, PREC_NONE},
     [TOKEN_NUMBER] = 	    {number, NULL, PREC_NONE},
     [TOKEN_AND] = 		    {NULL, binary, PREC_AND},
@@ -299,19 +679,52 @@ static ParseRule* getRule(TokenType type) {
 // Public methods
 ///////////////////
 
-bool compile(const char* source, Chunk* chunk) {
-    initScanner(source);
-    compilingChunk = chunk;
+static bool compileSource(VM* vm, const char* source, const char* const* columns, int columnCount, Chunk* chunk) {
+    Compiler compiler;
+    compiler.vm = vm;
+    initScanner(&compiler.scanner, source);
+    compiler.scanner.line = vm->firstLine;
+    compiler.chunk = chunk;
+    compiler.columns = columns;
+    compiler.columnCount = columnCount;
 
     // init parser
-    parser.hadError = false;
-    parser.panicMode = false;
+    compiler.parser.hadError = false;
+    compiler.parser.panicMode = false;
+    compiler.parser.previous.line = 0;
+
+    // the collector finds the constants through the vm
+    vm->compiler = &compiler;
 
     // prime compiler
-    advance();
-    expression();
-    consume(TOKEN_EOF, "Expect end of expression.");
-    endCompiler();
-    return !parser.hadError;
+    advance(&compiler);
+    expression(&compiler);
+    consume(&compiler, TOKEN_EOF, "Expect end of expression.");
+    endCompiler(&compiler);
+    vm->compiler = NULL;
+    return !compiler.parser.hadError;
+}
+
+bool compile(VM* vm, const char* source, Chunk* chunk) {
+    return compileSource(vm, source, NULL, 0, chunk);
 }
 
+bool compileColumns(VM* vm, const char* source, const char* const* columns, int columnCount, Chunk* chunk) {
+    // OP_COLUMN has a byte operand
+    if (columnCount > UINT8_MAX + 1) {
+        fprintf(vm->err, "Too many columns.\n");
+        return false;
+    }
+    return compileSource(vm, source, columns, columnCount, chunk);
+}
+
+void markCompilerRoots(VM* vm) {
+    if (vm->compiler != NULL) {
+        markArray(vm, &vm->compiler->chunk->constants);
+    }
+}
+
+int compilingLine(VM* vm) {
+    if (vm->compiler == NULL) return 0;
+    return vm->compiler->parser.previous.line;
+}
@@ -3,6 +3,23 @@
 
 #include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+// 0 compiles the code as written, 1 folds constants and runs the peephole
+// pass over the finished chunk. set by -O0/-O1, before compiling starts.
+extern int optimizationLevel;
+// string literals point into the source instead of copying it, only for
+// sources that stay alive until freeVM(). set by main for mapped files.
+extern bool borrowLiterals;
+
+// compile source into chunk, allocating in vm. compiles on different vms
+// can run at the same time.
+bool compile(VM* vm, const char* source, Chunk* chunk);
+// compile source as an expression over the input columns named by columns,
+// an identifier reads column i of the row being evaluated. the chunk is run
+// with runColumns(), see column.h.
+bool compileColumns(VM* vm, const char* source, const char* const* columns, int columnCount, Chunk* chunk);
+// mark constants of the chunk vm is compiling
+void markCompilerRoots(VM* vm);
+// line of the token vm is compiling, 0 when not compiling
+int compilingLine(VM* vm);
 
 #endif
\ No newline at end of file
@@ -1,13 +1,15 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "debug.h"
 #include "value.h"
 
-void disassembleChunk(Chunk* chunk, const char* name) {
+void disassembleChunk(VM* vm, Chunk* chunk, const char* name) {
     printf("== %s ==\n", name);
 
     for (int offset = 0; offset < chunk->count;) {
-        offset = disassembleInstruction(chunk, offset);
+        offset = disassembleInstruction(vm, chunk, offset);
     }
 }
 
@@ -16,28 +18,44 @@ static int simpleInstruction(const char* name, int offset) {
     return offset + 1;
 }
 
-static int constantInstruction(const char* name, int offset, Chunk* chunk) {
+static int byteInstruction(const char* name, int offset, Chunk* chunk) {
+    printf("%-16s %4d\n", name, chunk->code[offset + 1]);
+    return offset + 2;
+}
+
+static int constantInstruction(VM* vm, const char* name, int offset, Chunk* chunk) {
     int index = chunk->code[offset + 1];
     Value constant = chunk->constants.values[index];
     printf("%-16s %4d '", name, index);
-    printValue(constant);
+    printValue(vm, constant);
     printf("'\n");
     return offset + 2;
 }
 
-int disassembleInstruction(Chunk* chunk, int offset) {
+static int longConstantInstruction(VM* vm, const char* name, int offset, Chunk* chunk) {
+    int index = readLong(chunk, offset + 1);
+    Value constant = chunk->constants.values[index];
+    printf("%-16s %4d '", name, index);
+    printValue(vm, constant);
+    printf("'\n");
+    return offset + 4;
+}
+
+int disassembleInstruction(VM* vm, Chunk* chunk, int offset) {
     printf("%04d ", offset);
 
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset-1]) {
+    int line = getLine(chunk, offset);
+    if (offset > 0 && line == getLine(chunk, offset-1)) {
         printf("   | ");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", line);
     }
 
     uint8_t instruction = chunk->code[offset];
     switch (instruction) {
         case OP_RETURN: return simpleInstruction("OP_RETURN", offset);
-        case OP_CONSTANT: return constantInstruction("OP_CONSTANT", offset, chunk);
+        case OP_CONSTANT: return constantInstruction(vm, "OP_CONSTANT", offset, chunk);
+        case OP_CONSTANT_LONG: return longConstantInstruction(vm, "OP_CONSTANT_LONG", offset, chunk);
 
         case OP_NEGATE: return simpleInstruction("OP_NEGATE", offset);
         case OP_ADD: return simpleInstruction("OP_ADD", offset);
@@ -57,16 +75,196 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         case OP_LESS: return simpleInstruction("OP_LESS", offset);
         case OP_GREATER: return simpleInstruction("OP_GREATER", offset);
 
+        case OP_NOT_EQUAL: return simpleInstruction("OP_NOT_EQUAL", offset);
+        case OP_LESS_EQUAL: return simpleInstruction("OP_LESS_EQUAL", offset);
+        case OP_GREATER_EQUAL: return simpleInstruction("OP_GREATER_EQUAL", offset);
+        case OP_ADD_CONST: return constantInstruction(vm, "OP_ADD_CONST", offset, chunk);
+        case OP_MULTIPLY_CONST: return constantInstruction(vm, "OP_MULTIPLY_CONST", offset, chunk);
+
+        case OP_ADD_N: return byteInstruction("OP_ADD_N", offset, chunk);
+        case OP_COLUMN: return byteInstruction("OP_COLUMN", offset, chunk);
+
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
     }
 }
 
-void printValueStack(Value* stack, Value* stackTop) {
+void printValueStack(VM* vm, Value* stack, Value* stackTop) {
     printf("Value Stack: [ ");
     for (Value* cur = stack; cur < stackTop; cur++) {
-        printValue(*cur);
+        printValue(vm, *cur);
     }
     printf("]\n");
 }
+
+static const char* opcodeNames[] = {
+    [OP_RETURN] = "OP_RETURN",
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_NIL] = "OP_NIL",
+    [OP_NOT] = "OP_NOT",
+    [OP_AND] = "OP_AND",
+    [OP_OR] = "OP_OR",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_LESS] = "OP_LESS",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_NOT_EQUAL] = "OP_NOT_EQUAL",
+    [OP_LESS_EQUAL] = "OP_LESS_EQUAL",
+    [OP_GREATER_EQUAL] = "OP_GREATER_EQUAL",
+    [OP_ADD_CONST] = "OP_ADD_CONST",
+    [OP_MULTIPLY_CONST] = "OP_MULTIPLY_CONST",
+    [OP_ADD_N] = "OP_ADD_N",
+    [OP_COLUMN] = "OP_COLUMN",
+};
+
+#define OPCODE_COUNT ((int)(sizeof(opcodeNames) / sizeof(opcodeNames[0])))
+
+const char* opcodeName(uint8_t opcode) {
+    if (opcode >= OPCODE_COUNT || opcodeNames[opcode] == NULL) {
+        return "OP_UNKNOWN";
+    }
+    return opcodeNames[opcode];
+}
+
+// cost of reading the clock itself, taken off every sample
+static uint64_t tickOverhead() {
+    uint64_t overhead = UINT64_MAX;
+    for (int i = 0; i < 64; i++) {
+        uint64_t start = readTicks();
+        uint64_t ticks = readTicks() - start;
+        if (ticks < overhead) overhead = ticks;
+    }
+    return overhead;
+}
+
+typedef struct {
+    int index;
+    uint64_t count;
+    // estimated ticks spent in all executions
+    double ticks;
+} ProfileEntry;
+
+static int compareEntries(const void* a, const void* b) {
+    const ProfileEntry* entryA = (const ProfileEntry*)a;
+    const ProfileEntry* entryB = (const ProfileEntry*)b;
+    // descending by time, then by count
+    if (entryA->ticks != entryB->ticks) {
+        return (entryA->ticks < entryB->ticks) - (entryA->ticks > entryB->ticks);
+    }
+    return (entryA->count < entryB->count) - (entryA->count > entryB->count);
+}
+
+void printOpProfile(OpProfile* profile, Chunk* chunk) {
+    uint64_t overhead = tickOverhead();
+    ProfileEntry opcodes[256];
+    int opcodeCount = 0;
+    uint64_t total = 0;
+    double totalTicks = 0;
+    for (int opcode = 0; opcode < 256; opcode++) {
+        uint64_t count = profile->counts[opcode];
+        if (count == 0) continue;
+        double perOp = 0;
+        if (profile->samples[opcode] > 0) {
+            perOp = (double)profile->ticks[opcode] / profile->samples[opcode] - overhead;
+            if (perOp < 0) perOp = 0;
+        }
+        opcodes[opcodeCount++] = (ProfileEntry){opcode, count, perOp * count};
+        total += count;
+        totalTicks += perOp * count;
+    }
+    qsort(opcodes, opcodeCount, sizeof(ProfileEntry), compareEntries);
+
+    fprintf(stderr, "== opcodes ==\n");
+    fprintf(stderr, "%-20s %12s %7s %12s %7s\n", "opcode", "count", "", TICKS_UNIT "/op", "time");
+    for (int i = 0; i < opcodeCount; i++) {
+        ProfileEntry* entry = &opcodes[i];
+        fprintf(stderr, "%-20s %12llu %6.2f%% %12.1f %6.2f%%\n",
+                opcodeName(entry->index), (unsigned long long)entry->count,
+                100.0 * entry->count / total, entry->ticks / entry->count,
+                totalTicks > 0 ? 100.0 * entry->ticks / totalTicks : 0.0);
+    }
+
+    // offsets are only ranked by count, ticks are not kept per offset
+    ProfileEntry* offsets = (ProfileEntry*)malloc(sizeof(ProfileEntry) * chunk->count);
+    if (offsets != NULL) {
+        int offsetCount = 0;
+        for (int offset = 0; offset < chunk->count; offset++) {
+            uint64_t count = profile->offsetCounts[offset];
+            if (count == 0) continue;
+            offsets[offsetCount++] = (ProfileEntry){offset, count, 0};
+        }
+        qsort(offsets, offsetCount, sizeof(ProfileEntry), compareEntries);
+        // only the hottest offsets
+        if (offsetCount > 20) offsetCount = 20;
+
+        fprintf(stderr, "== hot offsets ==\n");
+        fprintf(stderr, "%-6s %-6s %-20s %12s %7s\n", "offset", "line", "opcode", "count", "");
+        for (int i = 0; i < offsetCount; i++) {
+            int offset = offsets[i].index;
+            fprintf(stderr, "%-6d %-6d %-20s %12llu %6.2f%%\n", offset, getLine(chunk, offset),
+                    opcodeName(chunk->code[offset]), (unsigned long long)offsets[i].count,
+                    100.0 * offsets[i].count / total);
+        }
+        free(offsets);
+    }
+
+    memset(profile->counts, 0, sizeof(profile->counts));
+    memset(profile->ticks, 0, sizeof(profile->ticks));
+    memset(profile->samples, 0, sizeof(profile->samples));
+}
+
+#ifdef DEBUG_PROFILE_OPCODE_PAIRS
+
+// pairCounts[previous][current]
+static uint64_t pairCounts[OPCODE_COUNT][OPCODE_COUNT];
+
+typedef struct {
+    uint8_t previous;
+    uint8_t current;
+    uint64_t count;
+} OpcodePair;
+
+void recordOpcodePair(uint8_t previous, uint8_t current) {
+    if (previous < OPCODE_COUNT && current < OPCODE_COUNT) {
+        pairCounts[previous][current]++;
+    }
+}
+
+static int comparePairs(const void* a, const void* b) {
+    uint64_t countA = ((const OpcodePair*)a)->count;
+    uint64_t countB = ((const OpcodePair*)b)->count;
+    // descending
+    return (countA < countB) - (countA > countB);
+}
+
+void printOpcodePairs() {
+    OpcodePair pairs[OPCODE_COUNT * OPCODE_COUNT];
+    int pairCount = 0;
+    uint64_t total = 0;
+    for (int previous = 0; previous < OPCODE_COUNT; previous++) {
+        for (int current = 0; current < OPCODE_COUNT; current++) {
+            uint64_t count = pairCounts[previous][current];
+            if (count == 0) continue;
+            pairs[pairCount++] = (OpcodePair){previous, current, count};
+            total += count;
+        }
+    }
+    qsort(pairs, pairCount, sizeof(OpcodePair), comparePairs);
+
+    fprintf(stderr, "== opcode pairs ==\n");
+    for (int i = 0; i < pairCount; i++) {
+        fprintf(stderr, "%12llu %6.2f%%  %s -> %s\n",
+                (unsigned long long)pairs[i].count, 100.0 * pairs[i].count / total,
+                opcodeName(pairs[i].previous), opcodeName(pairs[i].current));
+    }
+}
+
+#endif
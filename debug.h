@@ -3,12 +3,68 @@
 
 #include "chunk.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
 // #define DEBUG_DISASSEMBLE_CHUNK
 // #define DEBUG_PRINT_VALUE_STACK
+// count executed opcode pairs and print the most frequent ones at freeVM(),
+// tells which superinstructions pay off.
+// #define DEBUG_PROFILE_OPCODE_PAIRS
+// collect garbage on every allocation that grows memory
+// #define DEBUG_STRESS_GC
+// log every collection and print collector stats at freeVM()
+// #define DEBUG_LOG_GC
+// release and benchmark builds pass -DNDEBUG to keep the disassembly out of the output
+#ifndef NDEBUG
 #define DEBUG_PRINT_CODE
+#endif
+
+// opcode profiler, on with --profile-ops, see run.h.
+// every instruction is counted, ticks are sampled every
+// PROFILE_SAMPLE_INTERVAL instructions to keep the profiled loop close to
+// the plain one.
+#define PROFILE_SAMPLE_INTERVAL 8
+
+typedef struct {
+    bool enabled;
+    // indexed by opcode
+    uint64_t counts[256];
+    uint64_t ticks[256];
+    uint64_t samples[256];
+    // executions per offset of the running chunk, interpretChunk() sizes it
+    uint64_t* offsetCounts;
+} OpProfile;
+
+// time stamp counter where there is one, nanoseconds otherwise
+#if defined(__x86_64__) || defined(__i386__)
+#define TICKS_UNIT "cycles"
+static inline uint64_t readTicks() {
+    return __rdtsc();
+}
+#else
+#define TICKS_UNIT "ns"
+static inline uint64_t readTicks() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+#endif
+
+// constants are printed with printValue() on vm
+void disassembleChunk(VM* vm, Chunk* chunk, const char* name);
+int disassembleInstruction(VM* vm, Chunk* chunk, int offset);
+void printValueStack(VM* vm, Value* stack, Value* stackTop);
+const char* opcodeName(uint8_t opcode);
+// report the profile of chunk to stderr and clear the counters
+void printOpProfile(OpProfile* profile, Chunk* chunk);
 
-void disassembleChunk(Chunk* chunk, const char* name);
-int disassembleInstruction(Chunk* chunk, int offset);
-void printValueStack(Value* stack, Value* stackTop);
+#ifdef DEBUG_PROFILE_OPCODE_PAIRS
+void recordOpcodePair(uint8_t previous, uint8_t current);
+void printOpcodePairs();
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,900 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "jit.h"
+#include "value.h"
+
+JitMode jitMode = JIT_OFF;
+
+#ifdef JIT_SUPPORTED
+
+////////////////////
+// Value layout
+///////////////////
+
+#ifdef NAN_BOXING
+#define VALUE_SIZE 8
+#define PAYLOAD 0
+#else
+#define VALUE_SIZE ((int)sizeof(Value))
+#define TYPE ((int)offsetof(Value, type))
+#define PAYLOAD ((int)offsetof(Value, as))
+#endif
+
+////////////////////
+// Assembler
+///////////////////
+
+// registers by encoding. while jit code runs rbx holds vm->stackTop as it
+// was on entry, r12 &vm->ip, r13 &vm->stackTop, r14 QNAN and r15 vm.
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSI 6
+#define RDI 7
+#define R11 11
+#define R12 12
+#define R13 13
+#define R14 14
+
+// condition codes
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A 0x7
+#define CC_P 0xa
+#define CC_NP 0xb
+#define CC_ALWAYS -1
+
+// what the compiler knows about a stack slot, checks of known numbers and
+// bools are left out
+typedef enum {
+    KNOWN_NOTHING,
+    KNOWN_NUMBER,
+    KNOWN_BOOL,
+} Known;
+
+typedef struct {
+    // position of a rel32 and the label it jumps to
+    int position;
+    int label;
+} Fixup;
+
+typedef enum {
+    SLOW_ERROR,
+    // OP_ADD on anything but two numbers
+    SLOW_ADD,
+    // same for OP_ADD_CONST, the constant is pushed first
+    SLOW_ADD_CONST,
+    SLOW_ADD_N,
+} SlowKind;
+
+// out-of-line code of an instruction, entered when a type check fails
+typedef struct {
+    SlowKind kind;
+    int label;
+    // where the fast path continues
+    int resume;
+    int offset;
+    // stack depth at the start of the instruction
+    int depth;
+    int operand;
+    const char* message;
+} SlowPath;
+
+// shared code calling into the vm, see emitStubs()
+typedef struct {
+    void* function;
+    // a message for runtimeError() or a helper that returns false on error
+    const char* message;
+    bool canFail;
+    int label;
+} Stub;
+
+typedef struct {
+    Chunk* chunk;
+    uint8_t* code;
+    int count;
+    int capacity;
+    int* labels;
+    int labelCount;
+    int labelCapacity;
+    Fixup* fixups;
+    int fixupCount;
+    int fixupCapacity;
+    SlowPath* slowPaths;
+    int slowPathCount;
+    int slowPathCapacity;
+    Stub* stubs;
+    int stubCount;
+    int stubCapacity;
+    // all exits set eax and jump here
+    int epilogue;
+    // values on the stack at the current instruction
+    int depth;
+    Known known[STACK_MAX];
+} Assembler;
+
+// plain malloc(), the assembler's buffers are not vm memory
+#define GROW(type, array, count, capacity) do { \
+    if ((count) == (capacity)) { \
+        (capacity) = (capacity) < 8 ? 8 : (capacity) * 2; \
+        (array) = (type*)realloc((array), sizeof(type) * (capacity)); \
+        if ((array) == NULL) exit(1); \
+    } \
+} while(false)
+
+// one per thread, vms on different threads can compile at the same time
+static _Thread_local Assembler assembler;
+
+static void emitByte(uint8_t byte) {
+    GROW(uint8_t, assembler.code, assembler.count, assembler.capacity);
+    assembler.code[assembler.count++] = byte;
+}
+
+static void emitBytes(const uint8_t* bytes, int count) {
+    for (int i = 0; i < count; i++) emitByte(bytes[i]);
+}
+
+#define EMIT(...) do { \
+    const uint8_t bytes[] = {__VA_ARGS__}; \
+    emitBytes(bytes, (int)sizeof(bytes)); \
+} while(false)
+
+static void emit32(uint32_t value) {
+    for (int i = 0; i < 4; i++) emitByte((value >> (8 * i)) & 0xff);
+}
+
+static void emit64(uint64_t value) {
+    for (int i = 0; i < 8; i++) emitByte((value >> (8 * i)) & 0xff);
+}
+
+// ModRM for [rbx + disp], reg is a register or an opcode extension
+static void emitMemory(int reg, int disp) {
+    if (disp >= -128 && disp <= 127) {
+        emitByte(0x40 | (reg & 7) << 3 | RBX);
+        emitByte((uint8_t)disp);
+    } else {
+        emitByte(0x80 | (reg & 7) << 3 | RBX);
+        emit32((uint32_t)disp);
+    }
+}
+
+static int newLabel() {
+    GROW(int, assembler.labels, assembler.labelCount, assembler.labelCapacity);
+    assembler.labels[assembler.labelCount] = -1;
+    return assembler.labelCount++;
+}
+
+static void bindLabel(int label) {
+    assembler.labels[label] = assembler.count;
+}
+
+static void emitRelative(int label) {
+    GROW(Fixup, assembler.fixups, assembler.fixupCount, assembler.fixupCapacity);
+    assembler.fixups[assembler.fixupCount++] = (Fixup){assembler.count, label};
+    emit32(0);
+}
+
+static void jump(int condition, int label) {
+    if (condition == CC_ALWAYS) {
+        emitByte(0xe9);
+    } else {
+        EMIT(0x0f, 0x80 | condition);
+    }
+    emitRelative(label);
+}
+
+static void callLabel(int label) {
+    emitByte(0xe8);
+    emitRelative(label);
+}
+
+// mov reg, imm64
+static void moveImmediate(int reg, uint64_t value) {
+    EMIT(0x48 | (reg >= 8), 0xb8 | (reg & 7));
+    emit64(value);
+}
+
+// mov reg32, imm32
+static void moveImmediate32(int reg, uint32_t value) {
+    emitByte(0xb8 | reg);
+    emit32(value);
+}
+
+#ifdef NAN_BOXING
+// mov reg, [rbx + disp], only nan-boxed values are checked in a register
+static void loadMemory(int reg, int disp) {
+    EMIT(0x48 | (reg >= 8) << 2, 0x8b);
+    emitMemory(reg, disp);
+}
+#endif
+
+// mov [rbx + disp], reg
+static void storeMemory(int disp, int reg) {
+    EMIT(0x48 | (reg >= 8) << 2, 0x89);
+    emitMemory(reg, disp);
+}
+
+// movsd xmm, [rbx + disp]
+static void loadNumber(int xmm, int disp) {
+    EMIT(0xf2, 0x0f, 0x10);
+    emitMemory(xmm, disp + PAYLOAD);
+}
+
+// movsd [rbx + disp], xmm
+static void storeNumber(int disp, int xmm) {
+    EMIT(0xf2, 0x0f, 0x11);
+    emitMemory(xmm, disp + PAYLOAD);
+}
+
+// addsd/subsd/mulsd/divsd xmm0, [rbx + disp]
+static void numberOp(uint8_t op, int disp) {
+    EMIT(0xf2, 0x0f, op);
+    emitMemory(0, disp + PAYLOAD);
+}
+
+#define SSE_ADD 0x58
+#define SSE_MULTIPLY 0x59
+#define SSE_SUBTRACT 0x5c
+#define SSE_DIVIDE 0x5e
+
+static void callFunction(void* function) {
+    moveImmediate(R11, (uint64_t)(uintptr_t)function);
+    // call r11
+    EMIT(0x41, 0xff, 0xd3);
+}
+
+////////////////////
+// Stack
+///////////////////
+
+// the depth of the stack is known at every instruction, slots are
+// addressed from the base in rbx and the top lives only in the compiler
+
+// displacement of the nth value from the top, 1 is the top
+static int slot(int n) {
+    return (assembler.depth - n) * VALUE_SIZE;
+}
+
+static Known known(int n) {
+    return assembler.known[assembler.depth - n];
+}
+
+static void pushSlot(Known what) {
+    assembler.known[assembler.depth++] = what;
+}
+
+static void popSlots(int count) {
+    assembler.depth -= count;
+}
+
+static void setKnown(int n, Known what) {
+    assembler.known[assembler.depth - n] = what;
+}
+
+static Known knownValue(Value value) {
+    if (IS_NUMBER(value)) return KNOWN_NUMBER;
+    if (IS_BOOL(value)) return KNOWN_BOOL;
+    return KNOWN_NOTHING;
+}
+
+// jump to label unless the nth value is a number
+static void checkNumber(int n, int label) {
+    if (known(n) == KNOWN_NUMBER) return;
+#ifdef NAN_BOXING
+    // and rax, r14; cmp rax, r14
+    loadMemory(RAX, slot(n));
+    EMIT(0x4c, 0x21, 0xf0, 0x4c, 0x39, 0xf0);
+    jump(CC_E, label);
+#else
+    // cmp dword [type], imm8
+    emitByte(0x83);
+    emitMemory(7, slot(n) + TYPE);
+    emitByte(VAL_NUMBER);
+    jump(CC_NE, label);
+#endif
+}
+
+// store the bool in al to the nth value
+static void storeBool(int n) {
+    // movzx eax, al
+    EMIT(0x0f, 0xb6, 0xc0);
+#ifdef NAN_BOXING
+    // TRUE_VAL is FALSE_VAL | 1
+    moveImmediate(RCX, FALSE_VAL);
+    EMIT(0x48, 0x09, 0xc8);
+    storeMemory(slot(n), RAX);
+#else
+    storeMemory(slot(n) + PAYLOAD, RAX);
+    if (known(n) != KNOWN_BOOL) {
+        // mov dword [type], imm32
+        emitByte(0xc7);
+        emitMemory(0, slot(n) + TYPE);
+        emit32(VAL_BOOL);
+    }
+#endif
+    setKnown(n, KNOWN_BOOL);
+}
+
+static void storeValue(int disp, Value value) {
+#ifdef NAN_BOXING
+    moveImmediate(RAX, value);
+    storeMemory(disp, RAX);
+#else
+    uint64_t payload;
+    memcpy(&payload, &value.as, sizeof(payload));
+    moveImmediate(RAX, payload);
+    storeMemory(disp + PAYLOAD, RAX);
+    emitByte(0xc7);
+    emitMemory(0, disp + TYPE);
+    emit32(value.type);
+#endif
+}
+
+static void pushValue(Value value) {
+    storeValue(slot(0), value);
+    pushSlot(knownValue(value));
+}
+
+// al = isFalsey(nth value)
+static void testFalsey(int n) {
+#ifdef NAN_BOXING
+    loadMemory(RAX, slot(n));
+    moveImmediate(RCX, NIL_VAL());
+    // cmp rax, rcx; sete dl
+    EMIT(0x48, 0x39, 0xc8, 0x0f, 0x94, 0xc2);
+    moveImmediate(RCX, FALSE_VAL);
+    // cmp rax, rcx; sete al; or al, dl
+    EMIT(0x48, 0x39, 0xc8, 0x0f, 0x94, 0xc0, 0x08, 0xd0);
+#else
+    // mov eax, [type]
+    emitByte(0x8b);
+    emitMemory(RAX, slot(n) + TYPE);
+    // cmp eax, VAL_NIL; sete dl
+    emitByte(0x3d);
+    emit32(VAL_NIL);
+    EMIT(0x0f, 0x94, 0xc2);
+    // cmp eax, VAL_BOOL; sete cl
+    emitByte(0x3d);
+    emit32(VAL_BOOL);
+    EMIT(0x0f, 0x94, 0xc1);
+    // cmp byte [payload], 0; sete al
+    emitByte(0x80);
+    emitMemory(7, slot(n) + PAYLOAD);
+    emitByte(0);
+    EMIT(0x0f, 0x94, 0xc0);
+    // and al, cl; or al, dl
+    EMIT(0x20, 0xc8, 0x08, 0xd0);
+#endif
+}
+
+////////////////////
+// Calls into the vm
+///////////////////
+
+static int stub(void* function, const char* message, bool canFail) {
+    for (int i = 0; i < assembler.stubCount; i++) {
+        Stub* existing = &assembler.stubs[i];
+        if (existing->function == function && existing->message == message) return existing->label;
+    }
+    GROW(Stub, assembler.stubs, assembler.stubCount, assembler.stubCapacity);
+    int label = newLabel();
+    assembler.stubs[assembler.stubCount++] = (Stub){function, message, canFail, label};
+    return label;
+}
+
+// edi = offset; mov rax, code + 1; add rax, rdi; mov [r12], rax
+static void emitSetIp() {
+    moveImmediate(RAX, (uint64_t)(uintptr_t)(assembler.chunk->code + 1));
+    EMIT(0x48, 0x01, 0xf8, 0x49, 0x89, 0x04, 0x24);
+}
+
+// stubs are called with edi = offset of the instruction, rsi = vm->stackTop
+// and edx = argument of the function, which gets vm and the argument. error stubs are jumped to with the
+// offset only, runtimeError() resets the stack anyway.
+static void emitStubs() {
+    for (int i = 0; i < assembler.stubCount; i++) {
+        Stub* current = &assembler.stubs[i];
+        bindLabel(current->label);
+        if (current->message != NULL) {
+            emitSetIp();
+            // mov rdi, r15
+            EMIT(0x4c, 0x89, 0xff);
+            moveImmediate(RSI, (uint64_t)(uintptr_t)current->message);
+            // xor eax, eax, al holds the number of vector arguments
+            EMIT(0x31, 0xc0);
+            callFunction(current->function);
+            moveImmediate32(RAX, INTERPRET_RUNTIME_ERROR);
+            jump(CC_ALWAYS, assembler.epilogue);
+            continue;
+        }
+
+        // mov [r13], rsi
+        EMIT(0x49, 0x89, 0x75, 0x00);
+        emitSetIp();
+        // mov rdi, r15; mov esi, edx; sub rsp, 8 to realign
+        EMIT(0x4c, 0x89, 0xff, 0x89, 0xd6, 0x48, 0x83, 0xec, 0x08);
+        callFunction(current->function);
+        // add rsp, 8
+        EMIT(0x48, 0x83, 0xc4, 0x08);
+        if (!current->canFail) {
+            emitByte(0xc3);
+            continue;
+        }
+        // test al, al; jz failed; ret
+        EMIT(0x84, 0xc0, 0x74, 0x01, 0xc3);
+        // failed: drop the return address, the error is already reported
+        EMIT(0x48, 0x83, 0xc4, 0x08);
+        moveImmediate32(RAX, INTERPRET_RUNTIME_ERROR);
+        jump(CC_ALWAYS, assembler.epilogue);
+    }
+}
+
+// call function with the stack as it is at depth
+static void callVm(int offset, int depth, void* function, bool canFail, int argument) {
+    moveImmediate32(RDI, offset);
+    // lea rsi, [rbx + depth]
+    emitByte(0x48);
+    emitByte(0x8d);
+    emitMemory(RSI, depth * VALUE_SIZE);
+    moveImmediate32(RDX, argument);
+    callLabel(stub(function, NULL, canFail));
+}
+
+static void addSlowPath(SlowKind kind, int label, int resume, int offset,
+                        int operand, const char* message) {
+    GROW(SlowPath, assembler.slowPaths, assembler.slowPathCount, assembler.slowPathCapacity);
+    assembler.slowPaths[assembler.slowPathCount++] =
+        (SlowPath){kind, label, resume, offset, assembler.depth, operand, message};
+}
+
+// label of a runtime error raised by the instruction at offset, made on
+// first use so instructions on known numbers have none
+static int errorPath(int* label, int offset, const char* message) {
+    if (*label < 0) {
+        *label = newLabel();
+        addSlowPath(SLOW_ERROR, *label, -1, offset, 0, message);
+    }
+    return *label;
+}
+
+static void slowPath(SlowPath* path) {
+    bindLabel(path->label);
+    switch (path->kind) {
+        case SLOW_ERROR:
+            moveImmediate32(RDI, path->offset);
+            jump(CC_ALWAYS, stub((void*)runtimeError, path->message, true));
+            return;
+        case SLOW_ADD:
+            callVm(path->offset, path->depth, (void*)addValues, true, 0);
+            break;
+        case SLOW_ADD_CONST:
+            storeValue(path->depth * VALUE_SIZE, assembler.chunk->constants.values[path->operand]);
+            callVm(path->offset, path->depth + 1, (void*)addValues, true, 0);
+            break;
+        case SLOW_ADD_N:
+            callVm(path->offset, path->depth, (void*)addN, true, path->operand);
+            break;
+    }
+    jump(CC_ALWAYS, path->resume);
+}
+
+////////////////////
+// Templates
+///////////////////
+
+#define NUMBER_ERROR "Operands must be number."
+
+static void binaryNumbers(int offset, uint8_t op) {
+    int error = -1;
+    if (known(2) != KNOWN_NUMBER) checkNumber(2, errorPath(&error, offset, NUMBER_ERROR));
+    if (known(1) != KNOWN_NUMBER) checkNumber(1, errorPath(&error, offset, NUMBER_ERROR));
+    loadNumber(0, slot(2));
+    numberOp(op, slot(1));
+    storeNumber(slot(2), 0);
+    popSlots(1);
+    setKnown(1, KNOWN_NUMBER);
+}
+
+// a is compared with b by ucomisd, condition is the setcc for true
+static void compareNumbers(int offset, bool swap, int condition) {
+    int error = -1;
+    if (known(2) != KNOWN_NUMBER) checkNumber(2, errorPath(&error, offset, NUMBER_ERROR));
+    if (known(1) != KNOWN_NUMBER) checkNumber(1, errorPath(&error, offset, NUMBER_ERROR));
+    loadNumber(0, slot(swap ? 1 : 2));
+    loadNumber(1, slot(swap ? 2 : 1));
+    // ucomisd xmm0, xmm1; setcc al
+    EMIT(0x66, 0x0f, 0x2e, 0xc1, 0x0f, 0x90 | condition, 0xc0);
+    popSlots(1);
+    storeBool(1);
+}
+
+// fast path on numbers, anything else goes through addValues()
+static void add(int offset) {
+    bool numbers = known(2) == KNOWN_NUMBER && known(1) == KNOWN_NUMBER;
+    int resume = newLabel();
+    if (!numbers) {
+        int slow = newLabel();
+        addSlowPath(SLOW_ADD, slow, resume, offset, 0, NULL);
+        checkNumber(2, slow);
+        checkNumber(1, slow);
+    }
+    loadNumber(0, slot(2));
+    numberOp(SSE_ADD, slot(1));
+    storeNumber(slot(2), 0);
+    bindLabel(resume);
+    popSlots(1);
+    setKnown(1, numbers ? KNOWN_NUMBER : KNOWN_NOTHING);
+}
+
+static void constantOp(int offset, int index, uint8_t op) {
+    Value constant = assembler.chunk->constants.values[index];
+    if (!IS_NUMBER(constant)) {
+        if (op == SSE_ADD) {
+            storeValue(slot(0), constant);
+            callVm(offset, assembler.depth + 1, (void*)addValues, true, 0);
+            setKnown(1, KNOWN_NOTHING);
+        } else {
+            int error = -1;
+            jump(CC_ALWAYS, errorPath(&error, offset, NUMBER_ERROR));
+        }
+        return;
+    }
+
+    bool number = known(1) == KNOWN_NUMBER;
+    int resume = newLabel();
+    if (!number) {
+        int slow = newLabel();
+        if (op == SSE_ADD) {
+            addSlowPath(SLOW_ADD_CONST, slow, resume, offset, index, NULL);
+        } else {
+            addSlowPath(SLOW_ERROR, slow, -1, offset, 0, NUMBER_ERROR);
+        }
+        checkNumber(1, slow);
+    }
+    double value = AS_NUMBER(constant);
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    loadNumber(0, slot(1));
+    // movq xmm1, rax; addsd/mulsd xmm0, xmm1
+    moveImmediate(RAX, bits);
+    EMIT(0x66, 0x48, 0x0f, 0x6e, 0xc8, 0xf2, 0x0f, op, 0xc1);
+    storeNumber(slot(1), 0);
+    bindLabel(resume);
+    if (op != SSE_ADD) number = true;
+    setKnown(1, number ? KNOWN_NUMBER : KNOWN_NOTHING);
+}
+
+// sum count numbers from the left, like run()
+static void sumOperands(int offset, int count) {
+    bool numbers = true;
+    for (int i = count; i > 0; i--) numbers = numbers && known(i) == KNOWN_NUMBER;
+    int resume = newLabel();
+    if (!numbers) {
+        int slow = newLabel();
+        addSlowPath(SLOW_ADD_N, slow, resume, offset, count, NULL);
+        for (int i = count; i > 0; i--) checkNumber(i, slow);
+    }
+    loadNumber(0, slot(count));
+    for (int i = count - 1; i > 0; i--) numberOp(SSE_ADD, slot(i));
+    storeNumber(slot(count), 0);
+    bindLabel(resume);
+    popSlots(count - 1);
+    setKnown(1, numbers ? KNOWN_NUMBER : KNOWN_NOTHING);
+}
+
+static void equal(int offset, bool negate) {
+    Known a = known(2);
+    Known b = known(1);
+    if (a == KNOWN_NOTHING || b == KNOWN_NOTHING) {
+        callVm(offset, assembler.depth, (void*)equalValues, false, negate);
+        popSlots(1);
+        setKnown(1, KNOWN_BOOL);
+        return;
+    }
+
+    if (a != b) {
+        // a number never equals a bool, mov eax, negate
+        moveImmediate32(RAX, negate);
+    } else if (a == KNOWN_BOOL) {
+#ifdef NAN_BOXING
+        // mov rax, [a]; cmp rax, [b]
+        loadMemory(RAX, slot(2));
+        EMIT(0x48, 0x3b);
+        emitMemory(RAX, slot(1));
+#else
+        // mov al, [a]; cmp al, [b]
+        emitByte(0x8a);
+        emitMemory(RAX, slot(2) + PAYLOAD);
+        emitByte(0x3a);
+        emitMemory(RAX, slot(1) + PAYLOAD);
+#endif
+        EMIT(0x0f, 0x90 | (negate ? CC_NE : CC_E), 0xc0);
+    } else {
+        // ucomisd xmm0, xmm1, unordered sets ZF and PF
+        loadNumber(0, slot(2));
+        loadNumber(1, slot(1));
+        EMIT(0x66, 0x0f, 0x2e, 0xc1);
+        if (negate) {
+            // setne al; setp cl; or al, cl
+            EMIT(0x0f, 0x90 | CC_NE, 0xc0, 0x0f, 0x90 | CC_P, 0xc1, 0x08, 0xc8);
+        } else {
+            // sete al; setnp cl; and al, cl
+            EMIT(0x0f, 0x90 | CC_E, 0xc0, 0x0f, 0x90 | CC_NP, 0xc1, 0x20, 0xc8);
+        }
+    }
+    popSlots(1);
+    storeBool(1);
+}
+
+static void notValue() {
+    if (known(1) == KNOWN_BOOL) {
+        // xor byte [payload], 1, true and false differ in the lowest bit
+        emitByte(0x80);
+        emitMemory(6, slot(1) + PAYLOAD);
+        emitByte(1);
+        return;
+    }
+    if (known(1) == KNOWN_NUMBER) {
+        // numbers are never falsey
+        EMIT(0x31, 0xc0);
+    } else {
+        testFalsey(1);
+    }
+    storeBool(1);
+}
+
+static bool translate(int offset) {
+    Chunk* chunk = assembler.chunk;
+    uint8_t opcode = chunk->code[offset];
+
+    int pops;
+    int pushes;
+    if (!stackEffect(chunk, offset, &pops, &pushes) ||
+        assembler.depth < pops || assembler.depth + stackPeak(chunk, offset) >= STACK_MAX) {
+        return false;
+    }
+
+    int error = -1;
+    switch (opcode) {
+        case OP_RETURN:
+            callVm(offset, assembler.depth, (void*)printResult, false, 0);
+            popSlots(1);
+            moveImmediate32(RAX, INTERPRET_SUCCESS);
+            jump(CC_ALWAYS, assembler.epilogue);
+            return true;
+        case OP_CONSTANT:
+            pushValue(chunk->constants.values[chunk->code[offset + 1]]);
+            return true;
+        case OP_CONSTANT_LONG:
+            pushValue(chunk->constants.values[readLong(chunk, offset + 1)]);
+            return true;
+        case OP_NEGATE:
+            checkNumber(1, errorPath(&error, offset, "Operand must be a number."));
+            // btc qword [payload], 63
+            EMIT(0x48, 0x0f, 0xba);
+            emitMemory(7, slot(1) + PAYLOAD);
+            emitByte(63);
+            setKnown(1, KNOWN_NUMBER);
+            return true;
+        case OP_ADD: add(offset); return true;
+        case OP_SUBTRACT: binaryNumbers(offset, SSE_SUBTRACT); return true;
+        case OP_MULTIPLY: binaryNumbers(offset, SSE_MULTIPLY); return true;
+        case OP_DIVIDE: binaryNumbers(offset, SSE_DIVIDE); return true;
+        case OP_TRUE: pushValue(BOOL_VAL(true)); return true;
+        case OP_FALSE: pushValue(BOOL_VAL(false)); return true;
+        case OP_NIL: pushValue(NIL_VAL()); return true;
+        case OP_NOT: notValue(); return true;
+        case OP_AND:
+        case OP_OR:
+            return true;
+        case OP_EQUAL: equal(offset, false); return true;
+        case OP_NOT_EQUAL: equal(offset, true); return true;
+        // a < b is b > a, NaN compares unordered and sets no flag for seta
+        case OP_LESS: compareNumbers(offset, true, CC_A); return true;
+        case OP_GREATER: compareNumbers(offset, false, CC_A); return true;
+        case OP_LESS_EQUAL: compareNumbers(offset, false, CC_BE); return true;
+        case OP_GREATER_EQUAL: compareNumbers(offset, true, CC_BE); return true;
+        case OP_ADD_CONST: constantOp(offset, chunk->code[offset + 1], SSE_ADD); return true;
+        case OP_MULTIPLY_CONST: constantOp(offset, chunk->code[offset + 1], SSE_MULTIPLY); return true;
+        case OP_ADD_N: sumOperands(offset, chunk->code[offset + 1]); return true;
+        default:
+            return false;
+    }
+}
+
+static void freeAssembler() {
+    free(assembler.code);
+    free(assembler.labels);
+    free(assembler.fixups);
+    free(assembler.slowPaths);
+    free(assembler.stubs);
+    assembler = (Assembler){0};
+}
+
+bool compileJit(Chunk* chunk, JitCode* jit) {
+    assembler = (Assembler){0};
+    assembler.chunk = chunk;
+    assembler.epilogue = newLabel();
+
+    // push rbx, r12, r13, r14, r15, five pushes keep calls 16-byte aligned
+    EMIT(0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);
+    // mov r15, rdi; lea r12, [rdi + ip]; lea r13, [rdi + stackTop]
+    EMIT(0x49, 0x89, 0xff, 0x4c, 0x8d, 0xa7);
+    emit32((uint32_t)offsetof(VM, ip));
+    EMIT(0x4c, 0x8d, 0xaf);
+    emit32((uint32_t)offsetof(VM, stackTop));
+#ifdef NAN_BOXING
+    moveImmediate(R14, QNAN);
+#endif
+    // mov rbx, [r13]
+    EMIT(0x49, 0x8b, 0x5d, 0x00);
+
+    for (int offset = 0; offset < chunk->count; offset += opcodeLength(chunk->code[offset])) {
+        if (!translate(offset)) {
+            freeAssembler();
+            return false;
+        }
+    }
+
+    for (int i = 0; i < assembler.slowPathCount; i++) {
+        slowPath(&assembler.slowPaths[i]);
+    }
+    emitStubs();
+
+    bindLabel(assembler.epilogue);
+    EMIT(0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3);
+
+    for (int i = 0; i < assembler.fixupCount; i++) {
+        Fixup* fixup = &assembler.fixups[i];
+        int32_t distance = assembler.labels[fixup->label] - (fixup->position + 4);
+        memcpy(assembler.code + fixup->position, &distance, sizeof(distance));
+    }
+
+    // written while writable, then switched to executable
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t size = (assembler.count + pageSize - 1) / pageSize * pageSize;
+    void* code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        freeAssembler();
+        return false;
+    }
+    memcpy(code, assembler.code, assembler.count);
+    freeAssembler();
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size);
+        return false;
+    }
+
+    jit->code = code;
+    jit->size = size;
+    jit->function = (JitFunction)code;
+    return true;
+}
+
+void freeJit(JitCode* jit) {
+    munmap(jit->code, jit->size);
+    jit->code = NULL;
+    jit->function = NULL;
+}
+
+#else
+
+bool compileJit(Chunk* chunk, JitCode* jit) {
+    (void)chunk;
+    (void)jit;
+    return false;
+}
+
+void freeJit(JitCode* jit) {
+    (void)jit;
+}
+
+#endif
+
+////////////////////
+// Differential check
+///////////////////
+
+// output written to stream goes to a temporary file until endCapture()
+typedef struct {
+    FILE* stream;
+    FILE* file;
+    int saved;
+} Capture;
+
+static bool startCapture(Capture* capture, FILE* stream) {
+    fflush(stream);
+    capture->stream = stream;
+    capture->file = tmpfile();
+    if (capture->file == NULL) return false;
+    capture->saved = dup(fileno(stream));
+    if (capture->saved < 0 || dup2(fileno(capture->file), fileno(stream)) < 0) {
+        fclose(capture->file);
+        return false;
+    }
+    return true;
+}
+
+// restore the stream and return what was written to it, NUL terminated
+static char* endCapture(Capture* capture, size_t* length) {
+    fflush(capture->stream);
+    dup2(capture->saved, fileno(capture->stream));
+    close(capture->saved);
+
+    fseek(capture->file, 0L, SEEK_END);
+    *length = ftell(capture->file);
+    rewind(capture->file);
+    char* output = (char*)malloc(*length + 1);
+    if (output == NULL) exit(1);
+    *length = fread(output, 1, *length, capture->file);
+    output[*length] = '\0';
+    fclose(capture->file);
+    return output;
+}
+
+typedef struct {
+    InterpretResult result;
+    char* out;
+    size_t outLength;
+    char* err;
+    size_t errLength;
+} Outcome;
+
+static bool runCaptured(VM* vm, Chunk* chunk, InterpretResult (*function)(VM* vm), Outcome* outcome) {
+    Capture out;
+    Capture err;
+    if (!startCapture(&out, stdout)) return false;
+    if (!startCapture(&err, stderr)) {
+        free(endCapture(&out, &outcome->outLength));
+        return false;
+    }
+    vm->ip = chunk->code;
+    vm->stackTop = STACK_BASE(vm);
+    outcome->result = function(vm);
+    outcome->err = endCapture(&err, &outcome->errLength);
+    outcome->out = endCapture(&out, &outcome->outLength);
+    return true;
+}
+
+static bool sameOutcome(Outcome* a, Outcome* b) {
+    return a->result == b->result &&
+           a->outLength == b->outLength && memcmp(a->out, b->out, a->outLength) == 0 &&
+           a->errLength == b->errLength && memcmp(a->err, b->err, a->errLength) == 0;
+}
+
+InterpretResult checkJit(VM* vm, Chunk* chunk, JitCode* jit, InterpretResult (*interpret)(VM* vm)) {
+    Outcome expected;
+    Outcome actual;
+    if (!runCaptured(vm, chunk, interpret, &expected)) {
+        fprintf(stderr, "Could not capture output for the jit check.\n");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    fwrite(expected.out, 1, expected.outLength, stdout);
+    fwrite(expected.err, 1, expected.errLength, stderr);
+    if (!runCaptured(vm, chunk, jit->function, &actual)) {
+        fprintf(stderr, "Could not capture output for the jit check.\n");
+        free(expected.out);
+        free(expected.err);
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    InterpretResult result = expected.result;
+    if (!sameOutcome(&expected, &actual)) {
+        fprintf(stderr, "[jit] output differs from the interpreter\n");
+        fprintf(stderr, "-- interpreter, result %d --\n%s%s", expected.result, expected.out, expected.err);
+        fprintf(stderr, "-- jit, result %d --\n%s%s", actual.result, actual.out, actual.err);
+        result = INTERPRET_RUNTIME_ERROR;
+    }
+    free(expected.out);
+    free(expected.err);
+    free(actual.out);
+    free(actual.err);
+    return result;
+}
\ No newline at end of file
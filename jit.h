@@ -0,0 +1,42 @@
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "chunk.h"
+#include "vm.h"
+
+// template jit, every instruction of a finished chunk is translated to a
+// fixed sequence of x86-64 code. type checks and number arithmetic are
+// inline, strings, equality and errors call back into the vm. values stay
+// on vm->stack, the collector sees them as it does for run().
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#endif
+
+typedef enum {
+    JIT_OFF,
+    JIT_ON,
+    // run every chunk with the interpreter and the jit and compare output
+    JIT_CHECK,
+} JitMode;
+
+extern JitMode jitMode;
+
+// jit code is independent of the vm, any vm can run it
+typedef InterpretResult (*JitFunction)(VM* vm);
+
+typedef struct {
+    JitFunction function;
+    // executable mapping holding function
+    void* code;
+    size_t size;
+} JitCode;
+
+// false if the chunk can't be compiled, run() is used then
+bool compileJit(Chunk* chunk, JitCode* jit);
+void freeJit(JitCode* jit);
+// run chunk with the interpreter and then with the jit code, with stdout
+// and stderr captured. the interpreter's output is passed on, a difference
+// is reported on stderr and fails the run.
+InterpretResult checkJit(VM* vm, Chunk* chunk, JitCode* jit, InterpretResult (*interpret)(VM* vm));
+
+#endif
\ No newline at end of file
@@ -1,12 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "common.h"
+#include "aot.h"
+#include "batch.h"
+#include "cache.h"
 #include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
+#include "jit.h"
+#include "sampler.h"
 #include "vm.h"
 
+// the one vm of the command line
+static VM vm;
+
 static void repl() {
     char line[1024];
 
@@ -16,10 +29,22 @@ static void repl() {
             printf("\n");
             break;
         }
-        interpret(line);
+        interpret(&vm, line);
     }
 }
 
+// source of a script file
+typedef struct {
+    char* chars;
+    size_t length;
+    // chars are a mapping of the file instead of a heap copy
+    bool mapped;
+} Source;
+
+// the running script stays open until the vm is freed, string literals
+// borrow their chars from it
+static Source script = {NULL, 0, false};
+
 static char* readFile(const char* path) {
     FILE* file = fopen(path, "rb");
     if (file == NULL) {
@@ -49,29 +74,222 @@ static char* readFile(const char* path) {
     return buffer;
 }
 
-static void runFile(const char* path) {
-    char* source = readFile(path);
-    InterpretResult result = interpret(source);
-    free(source);
+// map the file when possible, the scanner needs a NUL after the last char.
+// the rest of a mapping's last page reads as zeros, so that only fails when
+// the file fills its last page exactly, then the file is read instead.
+static Source openSource(const char* path) {
+    Source source = {NULL, 0, false};
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > 0 && st.st_size % sysconf(_SC_PAGESIZE) != 0) {
+        void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            source.chars = (char*)mapping;
+            source.length = st.st_size;
+            source.mapped = true;
+        }
+    }
+    if (fd >= 0) close(fd);
 
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (!source.mapped) {
+        source.chars = readFile(path);
+        source.length = strlen(source.chars);
+    }
+    return source;
 }
 
-int main(int argc, const char* argv[]) {
-    initVM();
+static void closeSource(Source* source) {
+    if (source->chars == NULL) return;
+    if (source->mapped) {
+        munmap(source->chars, source->length);
+    } else {
+        free(source->chars);
+    }
+    source->chars = NULL;
+}
 
-    if (argc == 1) {
-        repl();
+static int exitCode(InterpretResult result) {
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+// return process exit code
+static int runFile(const char* path) {
+    // a cache written after the last change of the source skips compiling
+    char cachePath[4096];
+    chunkFilePath(path, cachePath, sizeof(cachePath));
+    if (chunkFileIsFresh(path, cachePath)) {
+        ChunkFile file;
+        if (openChunkFile(&vm, cachePath, &file)) {
+            InterpretResult result = interpretChunk(&vm, &file.chunk);
+            closeChunkFile(&vm, &file);
+            return exitCode(result);
+        }
+        // written by another version or damaged, compile the source instead
     }
-    else if (argc == 2) {
-        runFile(argv[1]);
-    } 
-    else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+
+    script = openSource(path);
+    borrowLiterals = script.mapped;
+    InterpretResult result = interpret(&vm, script.chars);
+    return exitCode(result);
+}
+
+// compile path without running it, false on a compile error
+static bool compileScript(const char* path, Chunk* chunk) {
+    script = openSource(path);
+    borrowLiterals = script.mapped;
+    initChunk(chunk);
+    if (!compile(&vm, script.chars, chunk)) {
+        freeChunk(&vm, chunk);
+        return false;
     }
+    return true;
+}
+
+// compile path and write the chunk next to it, return process exit code
+static int compileFile(const char* path) {
+    Chunk chunk;
+    if (!compileScript(path, &chunk)) return 65;
+
+    char cachePath[4096];
+    chunkFilePath(path, cachePath, sizeof(cachePath));
+    bool written = writeChunkFile(&chunk, cachePath);
+    freeChunk(&vm, &chunk);
+    if (!written) {
+        fprintf(stderr, "Could not write file %s.\n", cachePath);
+        return 74;
+    }
+    return 0;
+}
 
-    freeVM();
+// compile path and write it as C to outPath, return process exit code
+static int emitFile(const char* path, const char* outPath) {
+    Chunk chunk;
+    if (!compileScript(path, &chunk)) return 65;
+
+    FILE* out = fopen(outPath, "w");
+    if (out == NULL) {
+        freeChunk(&vm, &chunk);
+        fprintf(stderr, "Could not open file %s.\n", outPath);
+        return 74;
+    }
+    bool emitted = emitC(&chunk, path, out);
+    bool written = fclose(out) == 0;
+    freeChunk(&vm, &chunk);
+    if (!emitted || !written) {
+        fprintf(stderr, "Could not write file %s.\n", outPath);
+        return 74;
+    }
     return 0;
 }
+
+// run every line of path as its own script on threads workers, return
+// process exit code
+static int batchFile(const char* path, int threads) {
+    // lines are split in place, the file is read instead of mapped. it
+    // outlives the workers' vms, so literals can borrow from it.
+    script.chars = readFile(path);
+    script.length = strlen(script.chars);
+    borrowLiterals = true;
+    return runBatch(script.chars, threads);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: clox [-O0|-O1] [--jit|--jit-check] [--mem-stats] [--profile-ops]\n"
+                    "            [--sample=file] [--sample-rate=hz] [--compile-only|--emit-c=file] [path]\n"
+                    "       clox [-O0|-O1] [--jit] --batch [--threads=n] path\n");
+    exit(64);
+}
+
+int main(int argc, const char* argv[]) {
+    const char* path = NULL;
+    bool memStats = false;
+    bool compileOnly = false;
+    const char* emitPath = NULL;
+    bool profileOps = false;
+    const char* samplePath = NULL;
+    int sampleRate = SAMPLER_DEFAULT_HZ;
+    bool batch = false;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mem-stats") == 0) {
+            memStats = true;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jitMode = JIT_ON;
+        } else if (strcmp(argv[i], "--jit-check") == 0) {
+            jitMode = JIT_CHECK;
+        } else if (strcmp(argv[i], "--profile-ops") == 0) {
+            profileOps = true;
+        } else if (strncmp(argv[i], "--sample=", 9) == 0 && argv[i][9] != '\0') {
+            samplePath = argv[i] + 9;
+        } else if (strncmp(argv[i], "--sample-rate=", 14) == 0) {
+            char* end;
+            sampleRate = (int)strtol(argv[i] + 14, &end, 10);
+            if (end == argv[i] + 14 || *end != '\0' || sampleRate <= 0) usage();
+        } else if (strncmp(argv[i], "--emit-c=", 9) == 0 && argv[i][9] != '\0') {
+            emitPath = argv[i] + 9;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            char* end;
+            threads = (int)strtol(argv[i] + 10, &end, 10);
+            if (end == argv[i] + 10 || *end != '\0' || threads <= 0) usage();
+        } else if (strcmp(argv[i], "--compile-only") == 0) {
+            compileOnly = true;
+        } else if (strcmp(argv[i], "-O0") == 0) {
+            optimizationLevel = 0;
+        } else if (strcmp(argv[i], "-O1") == 0) {
+            optimizationLevel = 1;
+        } else if (argv[i][0] == '-' || path != NULL) {
+            usage();
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if ((compileOnly || emitPath != NULL) && path == NULL) usage();
+    // the profilers and the jit check follow one vm
+    if (batch && (path == NULL || compileOnly || emitPath != NULL || jitMode == JIT_CHECK ||
+                  memStats || profileOps || samplePath != NULL)) {
+        usage();
+    }
+
+    initVM(&vm);
+    // counters are always kept, attributing allocations to lines is opt-in
+    vm.memStats.profileSites = memStats;
+    vm.opProfile.enabled = profileOps;
+    if (samplePath != NULL && !startSampler(sampleRate)) {
+        fprintf(stderr, "Could not start the sampling profiler.\n");
+        samplePath = NULL;
+    }
+
+    int status = 0;
+    if (batch) {
+        status = batchFile(path, threads < 1 ? 1 : threads);
+    } else if (compileOnly) {
+        status = compileFile(path);
+    } else if (emitPath != NULL) {
+        status = emitFile(path, emitPath);
+    } else if (path == NULL) {
+        repl();
+    } else {
+        status = runFile(path);
+    }
+
+    if (samplePath != NULL) {
+        stopSampler();
+        if (!writeSamples(samplePath, path != NULL ? path : "repl")) {
+            fprintf(stderr, "Could not write file %s.\n", samplePath);
+        }
+    }
+    if (memStats) {
+        printMemStats(&vm);
+        printGCStats(&vm);
+    }
+    freeVM(&vm);
+    closeSource(&script);
+    return status;
+}
\ No newline at end of file
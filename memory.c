@@ -1,11 +1,71 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "memory.h"
 #include "vm.h"
 #include "object.h"
+#include "compiler.h"
+#include "debug.h"
+
+////////////////////
+// Accounting
+///////////////////
+
+static void recordSite(VM* vm, size_t bytes) {
+    MemStats* stats = &vm->memStats;
+    int line = currentLine(vm);
+    if (line < 0) line = 0;
+
+    // not allocated by reallocate(), must not start a collection
+    if (line >= stats->siteCapacity) {
+        int oldCapacity = stats->siteCapacity;
+        int capacity = GROW_CAPACITY(oldCapacity);
+        while (capacity <= line) capacity *= 2;
+        stats->sites = (AllocationSite*)realloc(stats->sites, sizeof(AllocationSite) * capacity);
+        if (stats->sites == NULL) exit(1);
+        for (int i = oldCapacity; i < capacity; i++) {
+            stats->sites[i] = (AllocationSite){0};
+        }
+        stats->siteCapacity = capacity;
+    }
+
+    AllocationSite* site = &stats->sites[line];
+    if (vm->chunk != NULL) {
+        site->runBytes += bytes;
+        site->runAllocations++;
+    } else {
+        site->compileBytes += bytes;
+        site->compileAllocations++;
+    }
+}
+
+static void recordAllocation(VM* vm, MemCategory category, size_t oldSize, size_t newSize) {
+    MemCategoryStats* stats = &vm->memStats.categories[category];
+    stats->live += newSize - oldSize;
+    if (newSize > oldSize) {
+        stats->allocations++;
+        if (stats->live > stats->peak) stats->peak = stats->live;
+        if (vm->memStats.profileSites) recordSite(vm, newSize - oldSize);
+    }
+}
 
 // this function can allocate and de-allocate memory.
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+// every growing allocation is a chance to collect garbage.
+void* reallocate(VM* vm, void* pointer, size_t oldSize, size_t newSize, MemCategory category) {
+    vm->bytesAllocated += newSize - oldSize;
+    recordAllocation(vm, category, oldSize, newSize);
+
+    if (newSize > oldSize && !vm->collecting) {
+        #ifdef DEBUG_STRESS_GC
+        collectGarbage(vm);
+        #else
+        if (vm->bytesAllocated > vm->nextGC) {
+            collectGarbage(vm);
+        }
+        #endif
+    }
+
     if (newSize == 0) {
         free(pointer);
         return NULL;
@@ -16,22 +76,427 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     return result;
 }
 
-static void freeObject(Obj* obj) {
+static const char* categoryNames[] = {
+    [MEM_CODE] = "code",
+    [MEM_LINES] = "lines",
+    [MEM_CONSTANTS] = "constants",
+    [MEM_STRING_HEADERS] = "string headers",
+    [MEM_STRING_CHARS] = "string chars",
+    [MEM_TABLE] = "intern table",
+    [MEM_NURSERY] = "nursery",
+};
+
+static int compareSites(const void* a, const void* b) {
+    const AllocationSite* siteA = *(const AllocationSite* const*)a;
+    const AllocationSite* siteB = *(const AllocationSite* const*)b;
+    size_t bytesA = siteA->compileBytes + siteA->runBytes;
+    size_t bytesB = siteB->compileBytes + siteB->runBytes;
+    // descending
+    return (bytesA < bytesB) - (bytesA > bytesB);
+}
+
+void printMemStats(VM* vm) {
+    MemStats* stats = &vm->memStats;
+    size_t live = 0;
+    size_t allocations = 0;
+
+    fprintf(stderr, "== memory ==\n");
+    fprintf(stderr, "%-16s %12s %12s %12s\n", "category", "live", "peak", "allocations");
+    for (int i = 0; i < MEM_CATEGORY_COUNT; i++) {
+        MemCategoryStats* category = &stats->categories[i];
+        fprintf(stderr, "%-16s %12zu %12zu %12zu\n",
+                categoryNames[i], category->live, category->peak, category->allocations);
+        live += category->live;
+        allocations += category->allocations;
+    }
+    fprintf(stderr, "%-16s %12zu %12s %12zu\n", "total", live, "", allocations);
+
+    if (!stats->profileSites) return;
+
+    AllocationSite** sorted = (AllocationSite**)malloc(sizeof(AllocationSite*) * stats->siteCapacity);
+    if (sorted == NULL) return;
+    int count = 0;
+    for (int line = 0; line < stats->siteCapacity; line++) {
+        AllocationSite* site = &stats->sites[line];
+        if (site->compileAllocations == 0 && site->runAllocations == 0) continue;
+        sorted[count++] = site;
+    }
+    qsort(sorted, count, sizeof(AllocationSite*), compareSites);
+    // only the top sites by bytes
+    if (count > 20) count = 20;
+
+    fprintf(stderr, "== allocation sites ==\n");
+    fprintf(stderr, "%-6s %14s %12s %14s %12s\n", "line", "compile bytes", "allocations", "run bytes", "allocations");
+    for (int i = 0; i < count; i++) {
+        AllocationSite* site = sorted[i];
+        int line = (int)(site - stats->sites);
+        fprintf(stderr, "%-6d %14zu %12zu %14zu %12zu\n", line,
+                site->compileBytes, site->compileAllocations, site->runBytes, site->runAllocations);
+    }
+    free(sorted);
+}
+
+static void freeObject(VM* vm, Obj* obj) {
+    #ifdef DEBUG_LOG_GC
+    printf("%p free type %d\n", (void*)obj, obj->type);
+    #endif
+
     switch(obj->type) {
         case OBJ_STRING:
             ObjString* objString = (ObjString*)obj;
-            FREE_ARRAY(char, objString->chars, objString->length + 1);
-            FREE(ObjString, objString);
+            // unflattened ropes have no chars, borrowed chars belong to the source
+            if (objString->chars != NULL && objString->ownsChars) {
+                FREE_ARRAY(vm, char, objString->chars, objString->length + 1, MEM_STRING_CHARS);
+            }
+            FREE(vm, ObjString, objString, MEM_STRING_HEADERS);
+            break;
+        default: return;
+    }
+}
+
+////////////////////
+// Nursery
+///////////////////
+
+// young objects are laid out back to back, keep each one pointer aligned
+#define ALIGN_YOUNG(size) (((size) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+static bool hasInlineChars(ObjString* string) {
+    return string->chars == (char*)(string + 1);
+}
+
+static size_t youngSize(Obj* obj) {
+    switch(obj->type) {
+        case OBJ_STRING:
+            ObjString* string = (ObjString*)obj;
+            // ropes are just a header
+            if (!hasInlineChars(string)) return ALIGN_YOUNG(sizeof(ObjString));
+            return ALIGN_YOUNG(sizeof(ObjString) + string->length + 1);
+        default: return ALIGN_YOUNG(sizeof(Obj));
+    }
+}
+
+// a young rope flattened in the nursery owns chars in the old heap, free
+// them if the rope died. promoted ropes handed them over already.
+static void freeYoungChars(VM* vm, Obj* obj) {
+    if (obj->type != OBJ_STRING || obj->next != NULL) return;
+
+    ObjString* string = (ObjString*)obj;
+    if (string->chars != NULL && !hasInlineChars(string)) {
+        FREE_ARRAY(vm, char, string->chars, string->length + 1, MEM_STRING_CHARS);
+    }
+}
+
+void initNursery(VM* vm) {
+    vm->nursery = (uint8_t*)malloc(NURSERY_SIZE);
+    if (vm->nursery == NULL) exit(1);
+    vm->nurseryTop = vm->nursery;
+    vm->nurseryEnd = vm->nursery + NURSERY_SIZE;
+}
+
+void freeNursery(VM* vm) {
+    for (uint8_t* cursor = vm->nursery; cursor < vm->nurseryTop; cursor += youngSize((Obj*)cursor)) {
+        freeYoungChars(vm, (Obj*)cursor);
+    }
+    free(vm->nursery);
+    vm->nursery = NULL;
+    vm->nurseryTop = NULL;
+    vm->nurseryEnd = NULL;
+}
+
+// allocation is a pointer bump, returns NULL if size doesn't belong in the nursery.
+// short-lived objects are never copied or freed one by one, a minor collection
+// promotes the survivors and resets the bump pointer.
+void* allocateYoung(VM* vm, size_t size) {
+    size = ALIGN_YOUNG(size);
+    if (size > NURSERY_MAX_OBJECT) return NULL;
+
+    #ifdef DEBUG_STRESS_GC
+    collectNursery(vm);
+    #endif
+
+    if (vm->nurseryTop + size > vm->nurseryEnd) {
+        collectNursery(vm);
+    }
+
+    void* result = vm->nurseryTop;
+    vm->nurseryTop += size;
+    recordAllocation(vm, MEM_NURSERY, 0, size);
+    return result;
+}
+
+// give back the most recent young allocation, anything else waits for the
+// next minor collection.
+void releaseYoung(VM* vm, void* pointer, size_t size) {
+    if ((uint8_t*)pointer + ALIGN_YOUNG(size) == vm->nurseryTop) {
+        vm->nurseryTop = (uint8_t*)pointer;
+        vm->memStats.categories[MEM_NURSERY].live -= ALIGN_YOUNG(size);
+    }
+}
+
+// return where obj lives after the minor collection
+static Obj* evacuate(VM* vm, Obj* obj) {
+    if (!obj->isYoung) return obj;
+
+    if (obj->next == NULL) {
+        size_t before = vm->bytesAllocated;
+        obj->next = promoteObject(vm, obj);
+        vm->gcStats.bytesPromoted += vm->bytesAllocated - before;
+
+        // references of the copy may still point into the nursery,
+        // the gray stack is free to use outside of major collections
+        if (vm->grayCapacity < vm->grayCount + 1) {
+            vm->grayCapacity = GROW_CAPACITY(vm->grayCapacity);
+            vm->grayStack = (Obj**)realloc(vm->grayStack, sizeof(Obj*) * vm->grayCapacity);
+            if (vm->grayStack == NULL) exit(1);
+        }
+        vm->grayStack[vm->grayCount++] = obj->next;
+    }
+    return obj->next;
+}
+
+static void evacuateReferences(VM* vm, Obj* obj) {
+    switch(obj->type) {
+        case OBJ_STRING:
+            ObjString* string = (ObjString*)obj;
+            if (string->left != NULL) string->left = (ObjString*)evacuate(vm, (Obj*)string->left);
+            if (string->right != NULL) string->right = (ObjString*)evacuate(vm, (Obj*)string->right);
+            break;
+        default: return;
+    }
+}
+
+static void evacuateValue(VM* vm, Value* slot) {
+    if (IS_OBJ(*slot)) {
+        *slot = OBJ_VAL(evacuate(vm, AS_OBJ(*slot)));
+    }
+}
+
+// copy young objects reachable from the value stack into the old space.
+// constants are created by the compiler in the old space, and old objects
+// never point into the nursery: a rope only gets children when it is created,
+// and a promoted rope has its children promoted in the same collection.
+// so the stack and vm->roots are the only roots and no remembered set is needed.
+void collectNursery(VM* vm) {
+    if (vm->nurseryTop == vm->nursery) return;
+
+    #ifdef DEBUG_LOG_GC
+    printf("-- minor gc begin\n");
+    #endif
+    bool wasCollecting = vm->collecting;
+    vm->collecting = true;
+    size_t used = vm->nurseryTop - vm->nursery;
+    size_t before = vm->gcStats.bytesPromoted;
+
+    for (Value* slot = STACK_BASE(vm); slot < vm->stackTop; slot++) {
+        evacuateValue(vm, slot);
+    }
+    for (int i = 0; i < vm->rootCount; i++) {
+        ValueSpan* span = &vm->roots[i];
+        for (int j = 0; j < span->count; j++) {
+            evacuateValue(vm, &span->values[j]);
+        }
+    }
+    // promoted copies whose references still point into the nursery
+    while (vm->grayCount > 0) {
+        evacuateReferences(vm, vm->grayStack[--vm->grayCount]);
+    }
+
+    // interned young strings either moved or died
+    for (uint8_t* cursor = vm->nursery; cursor < vm->nurseryTop;) {
+        Obj* obj = (Obj*)cursor;
+        if (obj->type == OBJ_STRING && ((ObjString*)obj)->isInterned) {
+            tableReplaceKey(&vm->strings, (ObjString*)obj, (ObjString*)obj->next);
+        }
+        freeYoungChars(vm, obj);
+        cursor += youngSize(obj);
+    }
+
+    vm->nurseryTop = vm->nursery;
+    vm->memStats.categories[MEM_NURSERY].live -= used;
+    vm->gcStats.minorCollections++;
+    vm->collecting = wasCollecting;
+
+    #ifdef DEBUG_LOG_GC
+    printf("-- minor gc end\n");
+    printf("   promoted %zu of %zu nursery bytes\n", vm->gcStats.bytesPromoted - before, used);
+    #else
+    (void)used;
+    (void)before;
+    #endif
+}
+
+////////////////////
+// Mark
+///////////////////
+
+void markObject(VM* vm, Obj* obj) {
+    if (obj == NULL || obj->isMarked) return;
+
+    #ifdef DEBUG_LOG_GC
+    printf("%p mark ", (void*)obj);
+    // printing a rope would flatten it
+    if (obj->type == OBJ_STRING && ((ObjString*)obj)->chars == NULL) {
+        printf("<rope>");
+    } else {
+        printValue(vm, OBJ_VAL(obj));
+    }
+    printf("\n");
+    #endif
+
+    obj->isMarked = true;
+
+    // gray stack is not allocated by reallocate(), growing it must not
+    // start another collection.
+    if (vm->grayCapacity < vm->grayCount + 1) {
+        vm->grayCapacity = GROW_CAPACITY(vm->grayCapacity);
+        vm->grayStack = (Obj**)realloc(vm->grayStack, sizeof(Obj*) * vm->grayCapacity);
+        if (vm->grayStack == NULL) exit(1);
+    }
+    vm->grayStack[vm->grayCount++] = obj;
+}
+
+void markValue(VM* vm, Value value) {
+    if (IS_OBJ(value)) markObject(vm, AS_OBJ(value));
+}
+
+void markArray(VM* vm, ValueArray* array) {
+    for (int i = 0; i < array->count; i++) {
+        markValue(vm, array->values[i]);
+    }
+}
+
+static void markRoots(VM* vm) {
+    for (Value* slot = STACK_BASE(vm); slot < vm->stackTop; slot++) {
+        markValue(vm, *slot);
+    }
+    for (int i = 0; i < vm->rootCount; i++) {
+        for (int j = 0; j < vm->roots[i].count; j++) {
+            markValue(vm, vm->roots[i].values[j]);
+        }
+    }
+    if (vm->chunk != NULL) {
+        markArray(vm, &vm->chunk->constants);
+    }
+    markCompilerRoots(vm);
+}
+
+// mark everything obj references
+static void blackenObject(VM* vm, Obj* obj) {
+    switch(obj->type) {
+        case OBJ_STRING:
+            // only ropes reference other strings
+            ObjString* string = (ObjString*)obj;
+            markObject(vm, (Obj*)string->left);
+            markObject(vm, (Obj*)string->right);
             break;
         default: return;
     }
 }
 
-void freeObjects() {
-    Obj* obj = vm.objects;
+static void traceReferences(VM* vm) {
+    while (vm->grayCount > 0) {
+        Obj* obj = vm->grayStack[--vm->grayCount];
+        blackenObject(vm, obj);
+    }
+}
+
+////////////////////
+// Sweep
+///////////////////
+
+// interned strings table holds weak references, drop strings about to be freed.
+static void removeWhiteStrings(VM* vm) {
+    for (int i = 0; i < vm->strings.capacity; i++) {
+        Entry* entry = &vm->strings.entries[i];
+        if (entry->key != NULL && !entry->key->obj.isMarked) {
+            tableDelete(&vm->strings, entry->key);
+        }
+    }
+}
+
+static void sweep(VM* vm) {
+    Obj* previous = NULL;
+    Obj* obj = vm->objects;
+    while (obj != NULL) {
+        if (obj->isMarked) {
+            // reset for next collection
+            obj->isMarked = false;
+            previous = obj;
+            obj = obj->next;
+        } else {
+            Obj* unreached = obj;
+            obj = obj->next;
+            if (previous != NULL) {
+                previous->next = obj;
+            } else {
+                vm->objects = obj;
+            }
+            freeObject(vm, unreached);
+        }
+    }
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void collectGarbage(VM* vm) {
+    #ifdef DEBUG_LOG_GC
+    printf("-- gc begin\n");
+    #endif
+    double start = now();
+    vm->collecting = true;
+
+    // only the old space is marked and swept, empty the nursery first
+    collectNursery(vm);
+    size_t before = vm->bytesAllocated;
+
+    markRoots(vm);
+    traceReferences(vm);
+    removeWhiteStrings(vm);
+    sweep(vm);
+
+    vm->collecting = false;
+    vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;
+
+    double pause = now() - start;
+    GCStats* stats = &vm->gcStats;
+    stats->collections++;
+    stats->bytesReclaimed += before - vm->bytesAllocated;
+    stats->totalPause += pause;
+    if (pause > stats->maxPause) stats->maxPause = pause;
+
+    #ifdef DEBUG_LOG_GC
+    printf("-- gc end\n");
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu, paused %.3f ms\n",
+           before - vm->bytesAllocated, before, vm->bytesAllocated, vm->nextGC, pause * 1e3);
+    #endif
+}
+
+void printGCStats(VM* vm) {
+    GCStats* stats = &vm->gcStats;
+    fprintf(stderr, "== gc ==\n");
+    fprintf(stderr, "collections     %d\n", stats->collections);
+    fprintf(stderr, "bytes reclaimed %zu\n", stats->bytesReclaimed);
+    fprintf(stderr, "minor collections %d\n", stats->minorCollections);
+    fprintf(stderr, "bytes promoted  %zu\n", stats->bytesPromoted);
+    fprintf(stderr, "total pause     %.3f ms\n", stats->totalPause * 1e3);
+    fprintf(stderr, "max pause       %.3f ms\n", stats->maxPause * 1e3);
+    if (stats->collections > 0) {
+        fprintf(stderr, "mean pause      %.3f ms\n", stats->totalPause * 1e3 / stats->collections);
+    }
+}
+
+void freeObjects(VM* vm) {
+    Obj* obj = vm->objects;
     while (obj != NULL) {
         Obj* next = obj->next;
-        freeObject(obj);
+        freeObject(vm, obj);
         obj = next;
     }
+    free(vm->grayStack);
+    free(vm->memStats.sites);
 }
\ No newline at end of file
@@ -2,21 +2,80 @@
 #define clox_memory_h
 
 #include "common.h"
+#include "value.h"
 
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity) * 2)
 
-#define FREE_ARRAY(type, pointer, oldCount) \
-    reallocate(pointer, sizeof(type)*(oldCount), 0)
+#define FREE_ARRAY(vm, type, pointer, oldCount, category) \
+    reallocate(vm, pointer, sizeof(type)*(oldCount), 0, category)
 
-#define GROW_ARRAY(type, pointer, oldCount, newCount) \
-    (type*)reallocate(pointer, sizeof(type)*(oldCount), sizeof(type)*(newCount))
+#define GROW_ARRAY(vm, type, pointer, oldCount, newCount, category) \
+    (type*)reallocate(vm, pointer, sizeof(type)*(oldCount), sizeof(type)*(newCount), category)
 
-#define ALLOCATE_ARRAY(type, size) (type*)reallocate(NULL, 0, sizeof(type)*(size))
+#define ALLOCATE_ARRAY(vm, type, size, category) (type*)reallocate(vm, NULL, 0, sizeof(type)*(size), category)
 
-#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+#define FREE(vm, type, pointer, category) reallocate(vm, pointer, sizeof(type), 0, category)
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize);
-void freeObjects();
+// what an allocation is for, memory stats are kept per category
+typedef enum {
+    MEM_CODE,
+    MEM_LINES,
+    MEM_CONSTANTS,
+    MEM_STRING_HEADERS,
+    MEM_STRING_CHARS,
+    // intern table
+    MEM_TABLE,
+    // young objects, bump allocated and not counted in vm->bytesAllocated
+    MEM_NURSERY,
+    MEM_CATEGORY_COUNT,
+} MemCategory;
+
+typedef struct {
+    size_t live;
+    size_t peak;
+    // growing calls to reallocate(), or bumps of the nursery pointer
+    size_t allocations;
+} MemCategoryStats;
+
+// bytes and allocations attributed to a source line
+typedef struct {
+    size_t compileBytes;
+    size_t compileAllocations;
+    size_t runBytes;
+    size_t runAllocations;
+} AllocationSite;
+
+typedef struct {
+    MemCategoryStats categories[MEM_CATEGORY_COUNT];
+    // allocation-site profiler, off unless profileSites is set.
+    // sites[line] for every line seen so far, grown with plain realloc().
+    bool profileSites;
+    AllocationSite* sites;
+    int siteCapacity;
+} MemStats;
+
+// grow heap threshold to this many times the live bytes after a collection
+#define GC_HEAP_GROW_FACTOR 2
+
+// size of the young generation
+#define NURSERY_SIZE (256 * 1024)
+// larger objects are allocated in the old space directly
+#define NURSERY_MAX_OBJECT (NURSERY_SIZE / 8)
+
+// memory of vm, every vm has its own heap and accounting
+void* reallocate(VM* vm, void* pointer, size_t oldSize, size_t newSize, MemCategory category);
+void initNursery(VM* vm);
+void freeNursery(VM* vm);
+void* allocateYoung(VM* vm, size_t size);
+void releaseYoung(VM* vm, void* pointer, size_t size);
+void collectNursery(VM* vm);
+void markObject(VM* vm, Obj* obj);
+void markValue(VM* vm, Value value);
+void markArray(VM* vm, ValueArray* array);
+void collectGarbage(VM* vm);
+void printGCStats(VM* vm);
+void printMemStats(VM* vm);
+void freeObjects(VM* vm);
 
 #endif
\ No newline at end of file
@@ -1,41 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "object.h"
 #include "memory.h"
 #include "vm.h"
+#include "table.h"
 
-#define ALLOCATE_OBJ(type, objType) (type*)allocateObj(sizeof(type), objType)
+#define ALLOCATE_OBJ(vm, type, objType, category) (type*)allocateObj(vm, sizeof(type), objType, category)
 
-static Obj* allocateObj(size_t size, ObjType type) {
-    Obj* obj = (Obj*)reallocate(NULL, 0, size); // allocate
+static Obj* allocateObj(VM* vm, size_t size, ObjType type, MemCategory category) {
+    Obj* obj = (Obj*)reallocate(vm, NULL, 0, size, category); // allocate
     obj->type = type;
-    obj->next = vm.objects;
-    vm.objects = obj;
+    obj->isMarked = false;
+    obj->isYoung = false;
+    obj->next = vm->objects;
+    vm->objects = obj;
     return obj;
 }
 
-static ObjString* allocateString(const char* chars, int length) {
-    ObjString* obj = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+static ObjString* allocateString(VM* vm, char* chars, int length, uint32_t hash) {
+    ObjString* obj = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING, MEM_STRING_HEADERS);
     obj->chars = chars;
+    obj->ownsChars = true;
     obj->length = length;
+    obj->hash = hash;
+    obj->isInterned = true;
+    obj->left = NULL;
+    obj->right = NULL;
+    // growing the table can trigger a collection, keep obj reachable
+    push(vm, OBJ_VAL(obj));
+    tableSet(vm, &vm->strings, obj, NIL_VAL());
+    pop(vm);
     return obj;
 }
 
-ObjString* copyString(const char* chars, int length) {
-    char* heapChars = ALLOCATE_ARRAY(char, length+1); // allocate
+// FNV-1a
+static uint32_t hashString(const char* chars, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+ObjString* copyString(VM* vm, const char* chars, int length) {
+    uint32_t hash = hashString(chars, length);
+    ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
+    if (interned != NULL) return interned;
+
+    char* heapChars = ALLOCATE_ARRAY(vm, char, length+1, MEM_STRING_CHARS); // allocate
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
-    return allocateString(heapChars, length);
+    return allocateString(vm, heapChars, length, hash);
 }
 
-ObjString* takeString(const char* chars, int length) {
+ObjString* takeString(VM* vm, char* chars, int length) {
+    uint32_t hash = hashString(chars, length);
+    ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
+    if (interned != NULL) {
+        // already have it, the caller's copy is not needed
+        FREE_ARRAY(vm, char, chars, length + 1, MEM_STRING_CHARS);
+        return interned;
+    }
+
     // no need to copy again
-    return allocateString(chars, length);
+    return allocateString(vm, chars, length, hash);
+}
+
+ObjString* borrowString(VM* vm, const char* chars, int length) {
+    uint32_t hash = hashString(chars, length);
+    ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
+    if (interned != NULL) return interned;
+
+    ObjString* string = allocateString(vm, (char*)chars, length, hash);
+    string->ownsChars = false;
+    return string;
+}
+
+ObjString* newString(VM* vm, int length) {
+    size_t size = sizeof(ObjString) + length + 1;
+    ObjString* obj = (ObjString*)allocateYoung(vm, size);
+    if (obj != NULL) {
+        // chars live right after the header
+        obj->obj.type = OBJ_STRING;
+        obj->obj.isMarked = false;
+        obj->obj.isYoung = true;
+        obj->obj.next = NULL;
+        obj->chars = (char*)(obj + 1);
+    } else {
+        // too big for the nursery
+        char* chars = ALLOCATE_ARRAY(vm, char, length+1, MEM_STRING_CHARS); // allocate
+        obj = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING, MEM_STRING_HEADERS);
+        obj->chars = chars;
+    }
+    obj->length = length;
+    obj->chars[length] = '\0';
+    obj->ownsChars = true;
+    obj->isInterned = false;
+    obj->left = NULL;
+    obj->right = NULL;
+    return obj;
+}
+
+ObjString* newRope(VM* vm, int length) {
+    ObjString* obj = (ObjString*)allocateYoung(vm, sizeof(ObjString));
+    if (obj != NULL) {
+        obj->obj.type = OBJ_STRING;
+        obj->obj.isMarked = false;
+        obj->obj.isYoung = true;
+        obj->obj.next = NULL;
+    } else {
+        obj = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING, MEM_STRING_HEADERS);
+    }
+    obj->length = length;
+    obj->chars = NULL;
+    obj->ownsChars = true;
+    obj->hash = 0;
+    obj->isInterned = false;
+    obj->left = NULL;
+    obj->right = NULL;
+    return obj;
+}
+
+ObjString* flattenString(VM* vm, ObjString* string) {
+    if (string->chars != NULL) return string;
+
+    // a collection now could move string and its children
+    bool wasCollecting = vm->collecting;
+    vm->collecting = true;
+    char* chars = ALLOCATE_ARRAY(vm, char, string->length+1, MEM_STRING_CHARS);
+    vm->collecting = wasCollecting;
+
+    // fill chars from the end, walking right children first. ropes built by
+    // long chains of + are deep, so use an explicit stack instead of recursion.
+    int capacity = 8;
+    int count = 0;
+    ObjString** stack = (ObjString**)malloc(sizeof(ObjString*) * capacity);
+    if (stack == NULL) exit(1);
+    stack[count++] = string;
+
+    int end = string->length;
+    while (count > 0) {
+        ObjString* node = stack[--count];
+        if (node->chars != NULL) {
+            end -= node->length;
+            memcpy(chars + end, node->chars, node->length);
+            continue;
+        }
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            stack = (ObjString**)realloc(stack, sizeof(ObjString*) * capacity);
+            if (stack == NULL) exit(1);
+        }
+        stack[count++] = node->left;
+        stack[count++] = node->right;
+    }
+    free(stack);
+
+    chars[string->length] = '\0';
+    string->chars = chars;
+    string->hash = hashString(chars, string->length);
+    // children are no longer needed, the collector can have them
+    string->left = NULL;
+    string->right = NULL;
+    return string;
+}
+
+bool stringsEqual(VM* vm, ObjString* a, ObjString* b) {
+    if (a == b) return true;
+    if (a->isInterned && b->isInterned) return false;
+    if (a->length != b->length) return false;
+
+    flattenString(vm, a);
+    flattenString(vm, b);
+    return a->hash == b->hash && memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+ObjString* internString(VM* vm, ObjString* string) {
+    string->hash = hashString(string->chars, string->length);
+    ObjString* interned = tableFindString(&vm->strings, string->chars, string->length, string->hash);
+    if (interned != NULL) {
+        // an unused young string costs nothing, the nursery takes it back if
+        // it was the last allocation. an old one is left for the collector.
+        if (string->obj.isYoung) {
+            releaseYoung(vm, string, sizeof(ObjString) + string->length + 1);
+        }
+        return interned;
+    }
+
+    string->isInterned = true;
+    // a collection while the table grows would move a young string after its
+    // address was taken as the key, hold collections off until it is in.
+    bool wasCollecting = vm->collecting;
+    vm->collecting = true;
+    tableSet(vm, &vm->strings, string, NIL_VAL());
+    vm->collecting = wasCollecting;
+    return string;
+}
+
+Obj* promoteObject(VM* vm, Obj* obj) {
+    switch(obj->type) {
+        case OBJ_STRING: {
+            ObjString* young = (ObjString*)obj;
+            char* chars = young->chars;
+            if (chars == (char*)(young + 1)) {
+                // chars are inline in the nursery
+                chars = ALLOCATE_ARRAY(vm, char, young->length+1, MEM_STRING_CHARS);
+                memcpy(chars, young->chars, young->length+1);
+            }
+            // a flattened young rope hands over its chars, an unflattened
+            // one keeps its young children until the collector moves them.
+            ObjString* old = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING, MEM_STRING_HEADERS);
+            old->chars = chars;
+            old->ownsChars = true;
+            old->length = young->length;
+            old->hash = young->hash;
+            old->isInterned = young->isInterned;
+            old->left = young->left;
+            old->right = young->right;
+            return (Obj*)old;
+        }
+        default: return obj;
+    }
+}
+
+ObjString* newSharedString(const char* chars, int length) {
+    // one block like a young string, chars right after the header
+    ObjString* string = (ObjString*)malloc(sizeof(ObjString) + length + 1);
+    if (string == NULL) exit(1);
+    string->obj.type = OBJ_STRING;
+    string->obj.isMarked = true;
+    string->obj.isYoung = false;
+    string->obj.next = NULL;
+    string->chars = (char*)(string + 1);
+    memcpy(string->chars, chars, length);
+    string->chars[length] = '\0';
+    string->length = length;
+    string->ownsChars = true;
+    string->hash = hashString(chars, length);
+    string->isInterned = false;
+    string->left = NULL;
+    string->right = NULL;
+    return string;
+}
+
+void freeSharedString(ObjString* string) {
+    free(string);
 }
 
-void printObj(Value value) {
+void printObj(VM* vm, Value value) {
     switch(OBJ_TYPE(value)) {
-        case OBJ_STRING: printf(AS_CSTRING(value)); break;
+        case OBJ_STRING: {
+            // borrowed chars are not NUL-terminated
+            ObjString* string = flattenString(vm, AS_STRING(value));
+            fprintf(vm->out, "%.*s", string->length, string->chars);
+            break;
+        }
         default: return;
     }
 }
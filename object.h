@@ -10,13 +10,38 @@ typedef enum {
 
 struct Obj{
     ObjType type;
+    // reachable in the current garbage collection
+    bool isMarked;
+    // allocated in the nursery, see allocateYoung()
+    bool isYoung;
+    // old objects: next object in vm->objects
+    // young objects: NULL, or the promoted copy once evacuated
     Obj* next;
 };
 
+// concatenations at least this long become ropes instead of being copied
+#ifndef ROPE_MIN_LENGTH
+#define ROPE_MIN_LENGTH 128
+#endif
+
+// flat strings are interned in vm->strings, two interned strings with the same
+// content are always the same object.
+// a rope is a string whose content is left followed by right, it is built in
+// constant time and only copied into chars once the content is needed.
 struct ObjString {
     Obj obj;
     int length;
+    // NULL while the string is an unflattened rope.
+    // NUL-terminated unless the string borrows its chars.
     char* chars;
+    // false when chars point into a source file that outlives the vm
+    bool ownsChars;
+    // computed once the content is known
+    uint32_t hash;
+    bool isInterned;
+    // rope children, NULL once flattened
+    ObjString* left;
+    ObjString* right;
 };
 
 static inline bool isObjType(Value value, ObjType type) {
@@ -28,13 +53,38 @@ static inline bool isObjType(Value value, ObjType type) {
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
 
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
-#define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
+// flattens ropes. borrowed chars are not NUL-terminated, use length.
+#define AS_CSTRING(vm, value) (flattenString(vm, AS_STRING(value))->chars)
 
 // input string not in heap, needs copy
-ObjString* copyString(const char* chars, int length);
+ObjString* copyString(VM* vm, const char* chars, int length);
 // input string already in heap
-ObjString* takeString(const char* chars, int length);
+ObjString* takeString(VM* vm, char* chars, int length);
+// input string outlives the vm, use it without copying
+ObjString* borrowString(VM* vm, const char* chars, int length);
+// string with room for length chars, short strings are bump allocated in the
+// nursery. the caller fills chars, then passes it to internString() before
+// anything else can allocate.
+ObjString* newString(VM* vm, int length);
+// hash and intern a string from newString(), return the interned string with
+// the same content if there already is one.
+ObjString* internString(VM* vm, ObjString* string);
+// rope of the given length, the caller sets left and right before anything
+// else can allocate.
+ObjString* newRope(VM* vm, int length);
+// copy the content of a rope into its chars, return the string.
+// never starts a collection, nothing moves.
+ObjString* flattenString(VM* vm, ObjString* string);
+// compare contents, interned strings are compared by pointer
+bool stringsEqual(VM* vm, ObjString* a, ObjString* b);
+// copy a young object into the old space
+Obj* promoteObject(VM* vm, Obj* obj);
+// string that belongs to no vm, for constants of shared chunks. it is
+// allocated with malloc(), stays marked so no collector ever writes to it,
+// is in no object list and is not interned, so vms compare it by content.
+ObjString* newSharedString(const char* chars, int length);
+void freeSharedString(ObjString* string);
 
-void printObj(Value value);
+void printObj(VM* vm, Value value);
 
 #endif
\ No newline at end of file
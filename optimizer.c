@@ -0,0 +1,122 @@
+#include <stdlib.h>
+
+#include "optimizer.h"
+#include "memory.h"
+
+// the comparison giving the opposite result, !(a < b) is a >= b.
+// OP_LESS_EQUAL is greater + not, so this holds for NaN too.
+static bool invertComparison(uint8_t* opcode) {
+    switch(*opcode) {
+        case OP_EQUAL: *opcode = OP_NOT_EQUAL; return true;
+        case OP_NOT_EQUAL: *opcode = OP_EQUAL; return true;
+        case OP_LESS: *opcode = OP_GREATER_EQUAL; return true;
+        case OP_GREATER_EQUAL: *opcode = OP_LESS; return true;
+        case OP_GREATER: *opcode = OP_LESS_EQUAL; return true;
+        case OP_LESS_EQUAL: *opcode = OP_GREATER; return true;
+        default: return false;
+    }
+}
+
+// replace a literal with its not, !nil is true
+static bool negateLiteral(uint8_t* opcode) {
+    switch(*opcode) {
+        case OP_TRUE: *opcode = OP_FALSE; return true;
+        case OP_FALSE:
+        case OP_NIL: *opcode = OP_TRUE; return true;
+        default: return false;
+    }
+}
+
+static bool producesBool(uint8_t opcode) {
+    switch(opcode) {
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NOT:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_LESS:
+        case OP_GREATER:
+        case OP_LESS_EQUAL:
+        case OP_GREATER_EQUAL:
+            return true;
+        default: return false;
+    }
+}
+
+// try to merge instruction op into the ones already written to out,
+// starts holds the offset of each instruction in out.
+static bool rewrite(VM* vm, Chunk* chunk, Chunk* out, int* starts, int* count, uint8_t op) {
+    if (*count == 0) return false;
+    uint8_t* last = &out->code[starts[*count - 1]];
+
+    switch(op) {
+        case OP_NOT:
+            if (invertComparison(last) || negateLiteral(last)) return true;
+            // !!x is x when x is already a bool, this also turns !!!x into !x
+            if (*last == OP_NOT && *count > 1 && producesBool(out->code[starts[*count - 2]])) {
+                truncateChunk(out, starts[--*count]);
+                return true;
+            }
+            return false;
+        case OP_NEGATE: {
+            // negating a number can't fail, use the negated constant instead
+            int index;
+            if (*last == OP_CONSTANT) {
+                index = last[1];
+            } else if (*last == OP_CONSTANT_LONG) {
+                index = readLong(out, starts[*count - 1] + 1);
+            } else {
+                return false;
+            }
+            Value value = chunk->constants.values[index];
+            if (!IS_NUMBER(value)) return false;
+            int constant = addConstant(vm, chunk, NUMBER_VAL(-AS_NUMBER(value)));
+            // the rewritten instruction has to keep its length
+            if (*last == OP_CONSTANT) {
+                if (constant > UINT8_MAX) return false;
+                last[1] = (uint8_t)constant;
+            } else {
+                if (constant >= MAX_CONSTANTS) return false;
+                last[1] = (uint8_t)constant;
+                last[2] = (uint8_t)(constant >> 8);
+                last[3] = (uint8_t)(constant >> 16);
+            }
+            return true;
+        }
+        default: return false;
+    }
+}
+
+// expressions have no jumps yet, so any instruction can be merged with the
+// one before it without checking for jump targets in between.
+void optimizeChunk(VM* vm, Chunk* chunk) {
+    Chunk out;
+    initChunk(&out);
+    int* starts = (int*)malloc(sizeof(int) * (chunk->count + 1));
+    if (starts == NULL) exit(1);
+    int count = 0;
+
+    for (int offset = 0; offset < chunk->count;) {
+        uint8_t op = chunk->code[offset];
+        int length = opcodeLength(op);
+        if (!rewrite(vm, chunk, &out, starts, &count, op)) {
+            starts[count++] = out.count;
+            int line = getLine(chunk, offset);
+            for (int i = 0; i < length; i++) {
+                writeChunk(vm, &out, chunk->code[offset + i], line);
+            }
+        }
+        offset += length;
+    }
+    free(starts);
+
+    // constants stay where they are, only code and lines are replaced
+    FREE_ARRAY(vm, uint8_t, chunk->code, chunk->capacity, MEM_CODE);
+    FREE_ARRAY(vm, LineStart, chunk->lines, chunk->lineCapacity, MEM_LINES);
+    chunk->code = out.code;
+    chunk->count = out.count;
+    chunk->capacity = out.capacity;
+    chunk->lines = out.lines;
+    chunk->lineCount = out.lineCount;
+    chunk->lineCapacity = out.lineCapacity;
+}
\ No newline at end of file
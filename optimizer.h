@@ -0,0 +1,10 @@
+#ifndef clox_optimizer_h
+#define clox_optimizer_h
+
+#include "chunk.h"
+
+// peephole pass over a finished chunk, rewrites short instruction sequences
+// into cheaper ones. the chunk is rebuilt, lines follow their instructions.
+void optimizeChunk(VM* vm, Chunk* chunk);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,291 @@
+// body of the interpreter loop, vm->c includes this once per variant.
+// RUN names the function, PROFILE_OPS compiles in the opcode profiler and
+// SAMPLE_IP publishes the instruction being run to the sampling profiler.
+// both are undefined at the end so the next variant can set them again.
+//
+// RUN() keeps the instruction pointer, the stack pointer and the value on
+// top of the stack in locals so they can live in registers:
+// - ip mirrors vm->ip
+// - the top of the stack is kept in `top` instead of memory
+// - sp points one past the last value below `top`, every value under the top
+//   sits in [STACK_BASE(vm), sp) and the stack is empty when sp == vm->stack.
+// pushing spills the old top to *sp, on an empty stack that old top is
+// garbage and lands in the reserved vm->stack[0].
+// SYNC() writes all of it back to vm before anything that reads the vm
+// stack or vm->ip (runtime errors, anything that allocates, tracing, return),
+// RELOAD() picks it up again afterwards, a collection may have moved the
+// strings on the stack.
+
+static InterpretResult RUN(VM* vm) {
+    register uint8_t* ip = vm->ip;
+    register Value* sp = vm->stackTop - 1;
+    register Value top = *sp;
+    Value* constants = vm->chunk->constants.values;
+
+    #define READ_BYTE() (*ip++)
+    #define READ_CONST() (constants[READ_BYTE()])
+    #define SYNC() do { vm->ip = ip; *sp = top; vm->stackTop = sp + 1; } while(false)
+    #define RELOAD() do { ip = vm->ip; sp = vm->stackTop - 1; top = *sp; } while(false)
+    #define PUSH(value) do { *sp++ = top; top = (value); } while(false)
+    #define RUNTIME_ERROR(msg) do { \
+        SYNC(); \
+        runtimeError(vm, msg); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while(false)
+    #define BINARY_OP(type, op) do { \
+        if (!IS_NUMBER(top) || !IS_NUMBER(sp[-1])) { \
+            RUNTIME_ERROR("Operands must be number."); \
+        } \
+        double b = AS_NUMBER(top); \
+        double a = AS_NUMBER(*--sp); \
+        top = type(a op b); \
+    } while(false)
+    #define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+    #ifdef DEBUG_PRINT_VALUE_STACK
+        #define TRACE_STACK() do { SYNC(); printValueStack(vm, STACK_BASE(vm), vm->stackTop); } while(false)
+    #else
+        #define TRACE_STACK() do {} while(false)
+    #endif
+    #ifdef DEBUG_DISASSEMBLE_CHUNK
+        #define TRACE_CODE() disassembleInstruction(vm, vm->chunk, (int)(ip - vm->chunk->code))
+    #else
+        #define TRACE_CODE() do {} while(false)
+    #endif
+    #ifdef DEBUG_PROFILE_OPCODE_PAIRS
+        // the first instruction of a chunk is paired with OP_RETURN,
+        // as if it followed the return of the previous chunk.
+        uint8_t previousOpcode = OP_RETURN;
+        #define TRACE_PAIR() do { \
+            recordOpcodePair(previousOpcode, *ip); \
+            previousOpcode = *ip; \
+        } while(false)
+    #else
+        #define TRACE_PAIR() do {} while(false)
+    #endif
+    #ifdef PROFILE_OPS
+        // every instruction is counted, every PROFILE_SAMPLE_INTERVAL-th one
+        // is timed until the next dispatch.
+        OpProfile* profile = &vm->opProfile;
+        uint8_t* code = vm->chunk->code;
+        int countdown = 1;
+        bool sampling = false;
+        uint8_t sampledOpcode = 0;
+        uint64_t sampleStart = 0;
+        #define TRACE_PROFILE() do { \
+            if (sampling) { \
+                profile->ticks[sampledOpcode] += readTicks() - sampleStart; \
+                profile->samples[sampledOpcode]++; \
+                sampling = false; \
+            } \
+            profile->counts[*ip]++; \
+            profile->offsetCounts[ip - code]++; \
+            if (--countdown == 0) { \
+                countdown = PROFILE_SAMPLE_INTERVAL; \
+                sampling = true; \
+                sampledOpcode = *ip; \
+                sampleStart = readTicks(); \
+            } \
+        } while(false)
+    #else
+        #define TRACE_PROFILE() do {} while(false)
+    #endif
+    #ifdef SAMPLE_IP
+        #define TRACE_SAMPLE() do { samplerIp = ip; } while(false)
+    #else
+        #define TRACE_SAMPLE() do {} while(false)
+    #endif
+    #define TRACE() do { \
+        TRACE_STACK(); TRACE_CODE(); TRACE_PAIR(); TRACE_PROFILE(); TRACE_SAMPLE(); \
+    } while(false)
+
+    // threaded dispatch jumps straight from the end of one opcode to the
+    // next one's label, every opcode gets its own indirect branch instead of
+    // sharing the switch's, and there is no bounds check on the opcode.
+    #ifdef THREADED_DISPATCH
+        static void* dispatchTable[] = {
+            [OP_RETURN] = &&L_OP_RETURN,
+            [OP_CONSTANT] = &&L_OP_CONSTANT,
+            [OP_CONSTANT_LONG] = &&L_OP_CONSTANT_LONG,
+            [OP_NEGATE] = &&L_OP_NEGATE,
+            [OP_ADD] = &&L_OP_ADD,
+            [OP_SUBTRACT] = &&L_OP_SUBTRACT,
+            [OP_MULTIPLY] = &&L_OP_MULTIPLY,
+            [OP_DIVIDE] = &&L_OP_DIVIDE,
+            [OP_TRUE] = &&L_OP_TRUE,
+            [OP_FALSE] = &&L_OP_FALSE,
+            [OP_NIL] = &&L_OP_NIL,
+            [OP_NOT] = &&L_OP_NOT,
+            [OP_AND] = &&L_OP_AND,
+            [OP_OR] = &&L_OP_OR,
+            [OP_EQUAL] = &&L_OP_EQUAL,
+            [OP_LESS] = &&L_OP_LESS,
+            [OP_GREATER] = &&L_OP_GREATER,
+            [OP_NOT_EQUAL] = &&L_OP_NOT_EQUAL,
+            [OP_LESS_EQUAL] = &&L_OP_LESS_EQUAL,
+            [OP_GREATER_EQUAL] = &&L_OP_GREATER_EQUAL,
+            [OP_ADD_CONST] = &&L_OP_ADD_CONST,
+            [OP_MULTIPLY_CONST] = &&L_OP_MULTIPLY_CONST,
+            [OP_ADD_N] = &&L_OP_ADD_N,
+            [OP_COLUMN] = &&L_OP_COLUMN,
+        };
+        #define DISPATCH() do { TRACE(); goto *dispatchTable[READ_BYTE()]; } while(false)
+        #define CASE(opcode) L_##opcode
+        #define NEXT() DISPATCH()
+
+        DISPATCH();
+    #else
+        #define CASE(opcode) case opcode
+        #define NEXT() break
+
+    for (;;) {
+        TRACE();
+
+        uint8_t instruction = READ_BYTE();
+
+        switch(instruction) {
+    #endif
+            CASE(OP_RETURN): {
+                Value result = top;
+                top = *--sp;
+                SYNC();
+                printValue(vm, result);
+                fprintf(vm->out, "\n");
+                return INTERPRET_SUCCESS;
+            }
+            // arithmetic
+            CASE(OP_CONSTANT): PUSH(READ_CONST()); NEXT();
+            CASE(OP_CONSTANT_LONG): {
+                int index = ip[0] | (ip[1] << 8) | (ip[2] << 16);
+                ip += 3;
+                PUSH(constants[index]);
+                NEXT();
+            }
+
+            CASE(OP_NEGATE):
+                if (!IS_NUMBER(top)) {
+                    RUNTIME_ERROR("Operand must be a number.");
+                }
+                top = NUMBER_VAL(-AS_NUMBER(top));
+                NEXT();
+            CASE(OP_ADD):
+                if (IS_NUMBER(top) && IS_NUMBER(sp[-1])) {
+                    double b = AS_NUMBER(top);
+                    double a = AS_NUMBER(*--sp);
+                    top = NUMBER_VAL(a+b);
+                } else if (IS_STRING(top) && IS_STRING(sp[-1])) {
+                    SYNC();
+                    concatenate(vm);
+                    RELOAD();
+                } else {
+                    RUNTIME_ERROR("Operands of '+' must be number or string.");
+                }
+                NEXT();
+            CASE(OP_SUBTRACT): BINARY_OP(NUMBER_VAL, -); NEXT();
+            CASE(OP_MULTIPLY): BINARY_OP(NUMBER_VAL, *); NEXT();
+            CASE(OP_DIVIDE): BINARY_OP(NUMBER_VAL, /); NEXT();
+
+            CASE(OP_TRUE): PUSH(BOOL_VAL(true)); NEXT();
+            CASE(OP_FALSE): PUSH(BOOL_VAL(false)); NEXT();
+            CASE(OP_NIL): PUSH(NIL_VAL()); NEXT();
+
+            CASE(OP_NOT): top = BOOL_VAL(isFalsey(top)); NEXT();
+            // TODO
+            CASE(OP_AND): NEXT();
+            CASE(OP_OR): NEXT();
+
+            CASE(OP_EQUAL): {
+                // comparing ropes flattens them, the allocation is counted at vm->ip
+                if (IS_STRING(top) && IS_STRING(sp[-1])) SYNC();
+                Value a = *--sp;
+                top = BOOL_VAL(valueEqual(vm, a, top));
+                NEXT();
+            }
+            CASE(OP_LESS): BINARY_OP(BOOL_VAL, <); NEXT();
+            CASE(OP_GREATER): BINARY_OP(BOOL_VAL, >); NEXT();
+
+            // superinstructions
+            CASE(OP_NOT_EQUAL): {
+                if (IS_STRING(top) && IS_STRING(sp[-1])) SYNC();
+                Value a = *--sp;
+                top = BOOL_VAL(!valueEqual(vm, a, top));
+                NEXT();
+            }
+            CASE(OP_LESS_EQUAL): BINARY_OP(NOT_BOOL_VAL, >); NEXT();
+            CASE(OP_GREATER_EQUAL): BINARY_OP(NOT_BOOL_VAL, <); NEXT();
+            CASE(OP_ADD_CONST): {
+                Value b = READ_CONST();
+                if (IS_NUMBER(b) && IS_NUMBER(top)) {
+                    top = NUMBER_VAL(AS_NUMBER(top) + AS_NUMBER(b));
+                } else if (IS_STRING(b) && IS_STRING(top)) {
+                    PUSH(b);
+                    SYNC();
+                    concatenate(vm);
+                    RELOAD();
+                } else {
+                    RUNTIME_ERROR("Operands of '+' must be number or string.");
+                }
+                NEXT();
+            }
+            CASE(OP_MULTIPLY_CONST): {
+                Value b = READ_CONST();
+                if (!IS_NUMBER(b) || !IS_NUMBER(top)) {
+                    RUNTIME_ERROR("Operands must be number.");
+                }
+                top = NUMBER_VAL(AS_NUMBER(top) * AS_NUMBER(b));
+                NEXT();
+            }
+
+            CASE(OP_ADD_N): {
+                int count = READ_BYTE();
+                // operands are sp[1-count] ... sp[-1], top
+                Value* operands = sp - (count - 1);
+                bool numbers = IS_NUMBER(top);
+                for (Value* operand = operands; numbers && operand < sp; operand++) {
+                    numbers = IS_NUMBER(*operand);
+                }
+                if (numbers) {
+                    double sum = AS_NUMBER(*operands);
+                    for (Value* operand = operands + 1; operand < sp; operand++) {
+                        sum += AS_NUMBER(*operand);
+                    }
+                    sum += AS_NUMBER(top);
+                    sp = operands;
+                    top = NUMBER_VAL(sum);
+                } else {
+                    SYNC();
+                    if (!addN(vm, count)) return INTERPRET_RUNTIME_ERROR;
+                    RELOAD();
+                }
+                NEXT();
+            }
+
+            // there are no columns outside of runColumns()
+            CASE(OP_COLUMN): RUNTIME_ERROR("Columns can only be read by runColumns().");
+    #ifndef THREADED_DISPATCH
+        }
+    }
+    #endif
+
+    #undef READ_BYTE
+    #undef READ_CONST
+    #undef SYNC
+    #undef RELOAD
+    #undef PUSH
+    #undef RUNTIME_ERROR
+    #undef BINARY_OP
+    #undef NOT_BOOL_VAL
+    #undef TRACE_STACK
+    #undef TRACE_CODE
+    #undef TRACE_PAIR
+    #undef TRACE_PROFILE
+    #undef TRACE_SAMPLE
+    #undef TRACE
+    #undef DISPATCH
+    #undef CASE
+    #undef NEXT
+}
+
+#undef RUN
+#undef PROFILE_OPS
+#undef SAMPLE_IP
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "sampler.h"
+#include "debug.h"
+
+_Thread_local uint8_t* volatile samplerIp = NULL;
+
+// state shared with the signal handler. the handler only reads these and
+// increments counters that were allocated before it could see them.
+static volatile sig_atomic_t running = false;
+static uint8_t* volatile code = NULL;
+static volatile int codeLength = 0;
+static uint64_t* volatile offsetSamples = NULL;
+// samples outside of run(): compiling, loading, printing the result
+static volatile uint64_t otherSamples = 0;
+
+// samples of finished chunks
+typedef struct {
+    int line;
+    uint8_t opcode;
+    uint64_t count;
+} SampledStack;
+
+static SampledStack* stacks = NULL;
+static int stackCount = 0;
+static int stackCapacity = 0;
+
+static void handleSample(int signal) {
+    (void)signal;
+    uint8_t* ip = samplerIp;
+    uint8_t* start = code;
+    uint64_t* samples = offsetSamples;
+    if (ip != NULL && samples != NULL && ip >= start && ip < start + codeLength) {
+        samples[ip - start]++;
+    } else {
+        otherSamples++;
+    }
+}
+
+static bool setTimer(int hz) {
+    struct itimerval timer = {0};
+    if (hz > 0) {
+        long interval = 1000000 / hz;
+        timer.it_interval.tv_sec = interval / 1000000;
+        timer.it_interval.tv_usec = interval % 1000000;
+        timer.it_value = timer.it_interval;
+    }
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+bool startSampler(int hz) {
+    if (hz <= 0 || hz > 1000000) return false;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleSample;
+    // interrupted reads and writes of the script carry on
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0) return false;
+
+    running = true;
+    if (!setTimer(hz)) {
+        running = false;
+        return false;
+    }
+    return true;
+}
+
+void stopSampler() {
+    if (!running) return;
+    setTimer(0);
+    signal(SIGPROF, SIG_IGN);
+    running = false;
+}
+
+bool samplerRunning() {
+    return running;
+}
+
+void samplerEnterChunk(Chunk* chunk) {
+    // plain calloc(), the profile is not part of the vm's memory
+    uint64_t* samples = (uint64_t*)calloc(chunk->count, sizeof(uint64_t));
+    if (samples == NULL) exit(1);
+    code = chunk->code;
+    codeLength = chunk->count;
+    offsetSamples = samples;
+}
+
+static void addSamples(int line, uint8_t opcode, uint64_t count) {
+    for (int i = 0; i < stackCount; i++) {
+        if (stacks[i].line == line && stacks[i].opcode == opcode) {
+            stacks[i].count += count;
+            return;
+        }
+    }
+    if (stackCount == stackCapacity) {
+        stackCapacity = stackCapacity < 8 ? 8 : stackCapacity * 2;
+        stacks = (SampledStack*)realloc(stacks, sizeof(SampledStack) * stackCapacity);
+        if (stacks == NULL) exit(1);
+    }
+    stacks[stackCount++] = (SampledStack){line, opcode, count};
+}
+
+void samplerLeaveChunk(Chunk* chunk) {
+    // unpublish before reading, a late sample counts as outside of run()
+    uint64_t* samples = offsetSamples;
+    offsetSamples = NULL;
+    code = NULL;
+    codeLength = 0;
+    if (samples == NULL) return;
+
+    for (int offset = 0; offset < chunk->count; offset++) {
+        if (samples[offset] == 0) continue;
+        addSamples(getLine(chunk, offset), chunk->code[offset], samples[offset]);
+    }
+    free(samples);
+}
+
+static int compareStacks(const void* a, const void* b) {
+    const SampledStack* stackA = (const SampledStack*)a;
+    const SampledStack* stackB = (const SampledStack*)b;
+    if (stackA->line != stackB->line) return (stackA->line > stackB->line) - (stackA->line < stackB->line);
+    return (stackA->opcode > stackB->opcode) - (stackA->opcode < stackB->opcode);
+}
+
+bool writeSamples(const char* path, const char* scriptName) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    // frames are separated by ';'
+    char root[256];
+    int length = 0;
+    for (const char* c = scriptName; *c != '\0' && length < (int)sizeof(root) - 1; c++) {
+        root[length++] = *c == ';' ? '_' : *c;
+    }
+    root[length] = '\0';
+
+    qsort(stacks, stackCount, sizeof(SampledStack), compareStacks);
+    for (int i = 0; i < stackCount; i++) {
+        fprintf(file, "%s;line %d;%s %llu\n", root, stacks[i].line,
+                opcodeName(stacks[i].opcode), (unsigned long long)stacks[i].count);
+    }
+    if (otherSamples > 0) {
+        fprintf(file, "%s;[outside bytecode] %llu\n", root, (unsigned long long)otherSamples);
+    }
+
+    free(stacks);
+    stacks = NULL;
+    stackCount = 0;
+    stackCapacity = 0;
+    return fclose(file) == 0;
+}
\ No newline at end of file
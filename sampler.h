@@ -0,0 +1,32 @@
+#ifndef clox_sampler_h
+#define clox_sampler_h
+
+#include "chunk.h"
+
+// sampling profiler. a SIGPROF timer interrupts the process at a fixed rate
+// of CPU time and the handler counts the instruction run() is at, by offset
+// of the running chunk. samples are aggregated by source line and opcode
+// when the chunk finishes and written as folded stacks, one line per stack:
+//
+//   script.lox;line 12;OP_ADD 37
+//
+// which flamegraph.pl and similar tools render directly.
+
+#define SAMPLER_DEFAULT_HZ 99
+
+// instruction being run, set by the sampled variants of run() at every
+// dispatch and NULL outside of them. one per thread, the handler reads the
+// one of the thread the signal interrupted. the sampler itself follows one
+// chunk at a time, profile one vm.
+extern _Thread_local uint8_t* volatile samplerIp;
+
+bool startSampler(int hz);
+void stopSampler();
+// collect samples for chunk while it runs
+void samplerEnterChunk(Chunk* chunk);
+void samplerLeaveChunk(Chunk* chunk);
+bool samplerRunning();
+// stacks are rooted at scriptName, false if the file can't be written
+bool writeSamples(const char* path, const char* scriptName);
+
+#endif
\ No newline at end of file
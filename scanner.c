@@ -2,66 +2,261 @@
 #include "common.h"
 #include "scanner.h"
 
-typedef struct {
-    const char* start;
-    const char* current;
-    int line;
-} Scanner;
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
 
-Scanner scanner;
+////////////////////
+// Kernels
+///////////////////
 
-void initScanner(const char* source) {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+// each kernel returns the first char at or after p that ends a run, or end.
+// the wide versions handle whole blocks and leave the tail to the scalar one.
+struct Kernels {
+    // skip ' ', '\t' and '\n', counting the newlines into lines
+    const char* (*skipSpace)(const char* p, const char* end, int* lines);
+    // find '\n', the end of a comment
+    const char* (*findNewline)(const char* p, const char* end);
+    // find '"' or '\n', the end of a string
+    const char* (*findStringEnd)(const char* p, const char* end);
+    // skip letters and digits
+    const char* (*skipIdentifier)(const char* p, const char* end);
+};
+
+static bool isIdentifierChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+static const char* skipSpaceScalar(const char* p, const char* end, int* lines) {
+    for (; p < end; p++) {
+        if (*p == '\n') {
+            (*lines)++;
+        } else if (*p != ' ' && *p != '\t') {
+            break;
+        }
+    }
+    return p;
+}
+
+static const char* findNewlineScalar(const char* p, const char* end) {
+    while (p < end && *p != '\n') p++;
+    return p;
+}
+
+static const char* findStringEndScalar(const char* p, const char* end) {
+    while (p < end && *p != '"' && *p != '\n') p++;
+    return p;
+}
+
+static const char* skipIdentifierScalar(const char* p, const char* end) {
+    while (p < end && isIdentifierChar(*p)) p++;
+    return p;
+}
+
+#ifdef SIMD_X86
+
+// bytes of block in [low, high], signed compare, chars >= 0x80 never match
+#define IN_RANGE_SSE2(block, low, high) _mm_and_si128( \
+    _mm_cmpgt_epi8(block, _mm_set1_epi8((low) - 1)), \
+    _mm_cmplt_epi8(block, _mm_set1_epi8((high) + 1)))
+
+static const char* skipSpaceSSE2(const char* p, const char* end, int* lines) {
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)p);
+        __m128i newline = _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'));
+        __m128i space = _mm_or_si128(newline, _mm_or_si128(
+            _mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+            _mm_cmpeq_epi8(block, _mm_set1_epi8('\t'))));
+        uint32_t newlines = (uint32_t)_mm_movemask_epi8(newline);
+        uint32_t other = ~(uint32_t)_mm_movemask_epi8(space) & 0xffff;
+        if (other != 0) {
+            int n = __builtin_ctz(other);
+            *lines += __builtin_popcount(newlines & ((1u << n) - 1));
+            return p + n;
+        }
+        *lines += __builtin_popcount(newlines);
+        p += 16;
+    }
+    return skipSpaceScalar(p, end, lines);
+}
+
+static const char* findNewlineSSE2(const char* p, const char* end) {
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)p);
+        uint32_t found = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')));
+        if (found != 0) return p + __builtin_ctz(found);
+        p += 16;
+    }
+    return findNewlineScalar(p, end);
 }
 
-static Token makeToken(TokenType type) {
+static const char* findStringEndSSE2(const char* p, const char* end) {
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)p);
+        uint32_t found = (uint32_t)_mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(block, _mm_set1_epi8('"')),
+            _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'))));
+        if (found != 0) return p + __builtin_ctz(found);
+        p += 16;
+    }
+    return findStringEndScalar(p, end);
+}
+
+static const char* skipIdentifierSSE2(const char* p, const char* end) {
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)p);
+        // setting bit 5 folds upper case letters onto lower case ones
+        __m128i lower = _mm_or_si128(block, _mm_set1_epi8(0x20));
+        __m128i identifier = _mm_or_si128(IN_RANGE_SSE2(lower, 'a', 'z'), IN_RANGE_SSE2(block, '0', '9'));
+        uint32_t other = ~(uint32_t)_mm_movemask_epi8(identifier) & 0xffff;
+        if (other != 0) return p + __builtin_ctz(other);
+        p += 16;
+    }
+    return skipIdentifierScalar(p, end);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+#define IN_RANGE_AVX2(block, low, high) _mm256_and_si256( \
+    _mm256_cmpgt_epi8(block, _mm256_set1_epi8((low) - 1)), \
+    _mm256_cmpgt_epi8(_mm256_set1_epi8((high) + 1), block))
+
+AVX2 static const char* skipSpaceAVX2(const char* p, const char* end, int* lines) {
+    while (end - p >= 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)p);
+        __m256i newline = _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n'));
+        __m256i space = _mm256_or_si256(newline, _mm256_or_si256(
+            _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')),
+            _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t'))));
+        uint32_t newlines = (uint32_t)_mm256_movemask_epi8(newline);
+        uint32_t other = ~(uint32_t)_mm256_movemask_epi8(space);
+        if (other != 0) {
+            int n = __builtin_ctz(other);
+            *lines += __builtin_popcount(newlines & (uint32_t)((1ull << n) - 1));
+            return p + n;
+        }
+        *lines += __builtin_popcount(newlines);
+        p += 32;
+    }
+    return skipSpaceSSE2(p, end, lines);
+}
+
+AVX2 static const char* findNewlineAVX2(const char* p, const char* end) {
+    while (end - p >= 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)p);
+        uint32_t found = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n')));
+        if (found != 0) return p + __builtin_ctz(found);
+        p += 32;
+    }
+    return findNewlineSSE2(p, end);
+}
+
+AVX2 static const char* findStringEndAVX2(const char* p, const char* end) {
+    while (end - p >= 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)p);
+        uint32_t found = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(block, _mm256_set1_epi8('"')),
+            _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n'))));
+        if (found != 0) return p + __builtin_ctz(found);
+        p += 32;
+    }
+    return findStringEndSSE2(p, end);
+}
+
+AVX2 static const char* skipIdentifierAVX2(const char* p, const char* end) {
+    while (end - p >= 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)p);
+        __m256i lower = _mm256_or_si256(block, _mm256_set1_epi8(0x20));
+        __m256i identifier = _mm256_or_si256(IN_RANGE_AVX2(lower, 'a', 'z'), IN_RANGE_AVX2(block, '0', '9'));
+        uint32_t other = ~(uint32_t)_mm256_movemask_epi8(identifier);
+        if (other != 0) return p + __builtin_ctz(other);
+        p += 32;
+    }
+    return skipIdentifierSSE2(p, end);
+}
+
+#endif
+
+static const Kernels scalarKernels = {
+    skipSpaceScalar, findNewlineScalar, findStringEndScalar, skipIdentifierScalar,
+};
+#ifdef SIMD_X86
+static const Kernels sse2Kernels = {
+    skipSpaceSSE2, findNewlineSSE2, findStringEndSSE2, skipIdentifierSSE2,
+};
+static const Kernels avx2Kernels = {
+    skipSpaceAVX2, findNewlineAVX2, findStringEndAVX2, skipIdentifierAVX2,
+};
+#endif
+
+static KernelChoice kernelChoice = {.sets = {
+    [SIMD_SCALAR] = &scalarKernels,
+    #ifdef SIMD_X86
+    [SIMD_SSE2] = &sse2Kernels,
+    [SIMD_AVX2] = &avx2Kernels,
+    #endif
+}};
+
+bool useScanKernels(ScanKernels choice) {
+    return chooseKernels(&kernelChoice, (SimdLevel)choice);
+}
+
+////////////////////
+// Scanner
+///////////////////
+
+void initScanner(Scanner* scanner, const char* source) {
+    scanner->kernels = pickKernels(&kernelChoice);
+    scanner->start = source;
+    scanner->current = source;
+    scanner->end = source + strlen(source);
+    scanner->line = 1;
+}
+
+static Token makeToken(Scanner* scanner, TokenType type) {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (scanner->current - scanner->start);
+    token.line = scanner->line;
     return token;
 }
-static Token makeErrorToken(const char* msg) {
+static Token makeErrorToken(Scanner* scanner, const char* msg) {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = msg;
     token.length = (int)strlen(msg);
-    token.line = scanner.line;
+    token.line = scanner->line;
     return token;
 }
 
-static bool isAtEnd() {
-    // dot has higher precedence than star
-    return *scanner.current == '\0';
+static bool isAtEnd(Scanner* scanner) {
+    return scanner->current == scanner->end;
 }
 
 // move current pointer forward
-static char advance() {
-    char ch = *scanner.current;
-    scanner.current++;
+static char advance(Scanner* scanner) {
+    char ch = *scanner->current;
+    scanner->current++;
     return ch;
 }
 
 // read char at current pointer
-static char peek() {
-    return *scanner.current;
+static char peek(Scanner* scanner) {
+    return *scanner->current;
 }
 
 // peek char next to current pointer
-static char peekNext() {
-    if (isAtEnd()) return '\0';
-    return scanner.current[1];
+static char peekNext(Scanner* scanner) {
+    if (isAtEnd(scanner)) return '\0';
+    return scanner->current[1];
 }
 
 // if match, consume and return true
-static bool match(char c) {
-    if (isAtEnd()) return false;
+static bool match(Scanner* scanner, char c) {
+    if (isAtEnd(scanner)) return false;
 
-    if (*scanner.current == c) {
-        scanner.current ++;
+    if (*scanner->current == c) {
+        scanner->current ++;
         return true;
     } else {
         return false;
@@ -76,19 +271,27 @@ static bool isAlpha(char c) {
     return c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z';
 }
 
-static void skipWhitespace() {
+static void skipWhitespace(Scanner* scanner) {
     for (;;) {
-        char c = peek();
-        switch(c) {
+        switch(peek(scanner)) {
             case '\n':
-                scanner.line ++;
+                scanner->line ++;
             case ' ':
             case '\t':
-                advance();
+                advance(scanner);
+                // single spaces between tokens are cheaper to skip here,
+                // runs such as indentation go to the kernel
+                switch(peek(scanner)) {
+                    case '\n':
+                    case ' ':
+                    case '\t':
+                        scanner->current = scanner->kernels->skipSpace(scanner->current, scanner->end, &scanner->line);
+                }
                 break;
             case '/':
-                if (peekNext() == '/') {
-                    while (peek() != '\n' && !isAtEnd()) advance();
+                if (peekNext(scanner) == '/') {
+                    // the comment ends at the newline, it is skipped as whitespace
+                    scanner->current = scanner->kernels->findNewline(scanner->current + 2, scanner->end);
                     break;
                 }
             default:
@@ -98,67 +301,66 @@ static void skipWhitespace() {
 }
 
 // scan string
-static Token string() {
-    while (!isAtEnd()) {
-        char c = advance();
-        if (c == '"') {
-            return makeToken(TOKEN_STRING);
-        } else if (c == '\n') {
-            return makeErrorToken("Unfinished string.");
-        }
+static Token string(Scanner* scanner) {
+    scanner->current = scanner->kernels->findStringEnd(scanner->current, scanner->end);
+    if (isAtEnd(scanner)) return makeErrorToken(scanner, "Unfinished string.");
+
+    char c = advance(scanner);
+    if (c == '"') {
+        return makeToken(scanner, TOKEN_STRING);
     }
-    return makeErrorToken("Unfinished string.");
+    return makeErrorToken(scanner, "Unfinished string.");
 }
 
 // scan number
-static Token number() {
-    while (isDigit(peek())) advance();
-    if (match('.')) {
-        while (isDigit(peek())) advance();
+static Token number(Scanner* scanner) {
+    while (isDigit(peek(scanner))) advance(scanner);
+    if (match(scanner, '.')) {
+        while (isDigit(peek(scanner))) advance(scanner);
     }
-    return makeToken(TOKEN_NUMBER);
+    return makeToken(scanner, TOKEN_NUMBER);
 }
 
-static TokenType checkKeyword(const char* keyword, int length, TokenType type) {
-    if (scanner.current - scanner.start == length &&
-        memcmp(scanner.start, keyword, length) == 0) {
+static TokenType checkKeyword(Scanner* scanner, const char* keyword, int length, TokenType type) {
+    if (scanner->current - scanner->start == length &&
+        memcmp(scanner->start, keyword, length) == 0) {
         return type;
     } else {
         return TOKEN_IDENTIFIER;
     }
 }
 
-static TokenType identifierType() {
+static TokenType identifierType(Scanner* scanner) {
     // match keywords
-    switch(scanner.start[0]) {
-        case 'a': return checkKeyword("and", 3, TOKEN_AND);
-        case 'c': return checkKeyword("class", 5, TOKEN_CLASS);
-        case 'e': return checkKeyword("else", 4, TOKEN_ELSE);
+    switch(scanner->start[0]) {
+        case 'a': return checkKeyword(scanner, "and", 3, TOKEN_AND);
+        case 'c': return checkKeyword(scanner, "class", 5, TOKEN_CLASS);
+        case 'e': return checkKeyword(scanner, "else", 4, TOKEN_ELSE);
         case 'f': 
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a': return checkKeyword("false", 5, TOKEN_FALSE);
-                    case 'o': return checkKeyword("for", 3, TOKEN_FOR);
-                    case 'u': return checkKeyword("fun", 3, TOKEN_FUN);
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'a': return checkKeyword(scanner, "false", 5, TOKEN_FALSE);
+                    case 'o': return checkKeyword(scanner, "for", 3, TOKEN_FOR);
+                    case 'u': return checkKeyword(scanner, "fun", 3, TOKEN_FUN);
                 }
             }
             break;
-        case 'i': return checkKeyword("if", 2, TOKEN_IF);
-        case 'n': return checkKeyword("nil", 3, TOKEN_NIL);
-        case 'o': return checkKeyword("or", 2, TOKEN_OR);
-        case 'p': return checkKeyword("print", 5, TOKEN_PRINT);
-        case 'r': return checkKeyword("return", 5, TOKEN_RETURN);
-        case 's': return checkKeyword("super", 5, TOKEN_SUPER);
+        case 'i': return checkKeyword(scanner, "if", 2, TOKEN_IF);
+        case 'n': return checkKeyword(scanner, "nil", 3, TOKEN_NIL);
+        case 'o': return checkKeyword(scanner, "or", 2, TOKEN_OR);
+        case 'p': return checkKeyword(scanner, "print", 5, TOKEN_PRINT);
+        case 'r': return checkKeyword(scanner, "return", 5, TOKEN_RETURN);
+        case 's': return checkKeyword(scanner, "super", 5, TOKEN_SUPER);
         case 't':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'h': return checkKeyword("this", 4, TOKEN_THIS);
-                    case 'r': return checkKeyword("true", 4, TOKEN_TRUE);
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'h': return checkKeyword(scanner, "this", 4, TOKEN_THIS);
+                    case 'r': return checkKeyword(scanner, "true", 4, TOKEN_TRUE);
                 }
             }
             break;
-        case 'v': return checkKeyword("var", 3, TOKEN_VAR);
-        case 'w': return checkKeyword("while", 5, TOKEN_WHILE);
+        case 'v': return checkKeyword(scanner, "var", 3, TOKEN_VAR);
+        case 'w': return checkKeyword(scanner, "while", 5, TOKEN_WHILE);
     }
 
     // if no keywords matched, it is an identifier
@@ -166,44 +368,50 @@ static TokenType identifierType() {
 }
 
 // scan identifier
-static Token identifier() {
-    while (isAlpha(peek()) || isDigit(peek())) advance();
-    return makeToken(identifierType());
+static Token identifier(Scanner* scanner) {
+    // most identifiers and keywords are short, only longer ones are worth
+    // a wide scan
+    for (int i = 0; i < 8; i++) {
+        if (!isIdentifierChar(peek(scanner))) return makeToken(scanner, identifierType(scanner));
+        advance(scanner);
+    }
+    scanner->current = scanner->kernels->skipIdentifier(scanner->current, scanner->end);
+    return makeToken(scanner, identifierType(scanner));
 }
 
-Token scanToken() {
+Token scanToken(Scanner* scanner) {
     // this function must return a valid token, hence all meaningless tokens must be skipped
     // at the start.
-    skipWhitespace();
+    skipWhitespace(scanner);
 
-    scanner.start = scanner.current;
+    scanner->start = scanner->current;
 
-    if(isAtEnd()) return makeToken(TOKEN_EOF);
+    if(isAtEnd(scanner)) return makeToken(scanner, TOKEN_EOF);
 
-    char ch = advance();
+    char ch = advance(scanner);
 
-    if (isDigit(ch)) return number();
-    if (isAlpha(ch)) return identifier();
+    if (isDigit(ch)) return number(scanner);
+    if (isAlpha(ch)) return identifier(scanner);
     
 
     switch(ch) {
-        case '(': return makeToken(TOKEN_LEFT_PAREN);
-        case ')': return makeToken(TOKEN_RIGHT_PAREN);
-        case '{': return makeToken(TOKEN_LEFT_BRACE);
-        case '}': return makeToken(TOKEN_RIGHT_BRACE);
-        case ',': return makeToken(TOKEN_COMMA);
-        case '.': return makeToken(TOKEN_DOT);
-        case '-': return makeToken(TOKEN_MINUS);
-        case '+': return makeToken(TOKEN_PLUS);
-        case ';': return makeToken(TOKEN_SEMICOLON);
-        case '*': return makeToken(TOKEN_STAR);
-        case '/': return makeToken(TOKEN_SLASH);
-        case '!': return match('=') ? makeToken(TOKEN_BANG_EQUAL) : makeToken(TOKEN_BANG);
-        case '>': return match('=') ? makeToken(TOKEN_GREATER_EQUAL) : makeToken(TOKEN_GREATER);
-        case '<': return match('=') ? makeToken(TOKEN_LESS_EQUAL) : makeToken(TOKEN_LESS);
-        case '=': return match('=') ? makeToken(TOKEN_EQUAL_EQUAL) : makeToken(TOKEN_EQUAL);
-        case '"': return string();
-    }
-
-    return makeErrorToken("Unexpected character.");
+        case '(': return makeToken(scanner, TOKEN_LEFT_PAREN);
+        case ')': return makeToken(scanner, TOKEN_RIGHT_PAREN);
+        case '{': return makeToken(scanner, TOKEN_LEFT_BRACE);
+        case '}': return makeToken(scanner, TOKEN_RIGHT_BRACE);
+        case ',': return makeToken(scanner, TOKEN_COMMA);
+        case '.': return makeToken(scanner, TOKEN_DOT);
+        case '-': return makeToken(scanner, TOKEN_MINUS);
+        case '+': return makeToken(scanner, TOKEN_PLUS);
+        case ';': return makeToken(scanner, TOKEN_SEMICOLON);
+        case '*': return makeToken(scanner, TOKEN_STAR);
+        case '/': return makeToken(scanner, TOKEN_SLASH);
+        case '!': return match(scanner, '=') ? makeToken(scanner, TOKEN_BANG_EQUAL) : makeToken(scanner, TOKEN_BANG);
+        case '>': return match(scanner, '=') ? makeToken(scanner, TOKEN_GREATER_EQUAL) : makeToken(scanner, TOKEN_GREATER);
+        case '<': return match(scanner, '=') ? makeToken(scanner, TOKEN_LESS_EQUAL) : makeToken(scanner, TOKEN_LESS);
+        case '=': return match(scanner, '=') ? makeToken(scanner, TOKEN_EQUAL_EQUAL) : makeToken(scanner, TOKEN_EQUAL);
+        case '"': return string(scanner);
+    }
+
+    return makeErrorToken(scanner, "Unexpected character.");
 }
\ No newline at end of file
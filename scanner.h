@@ -1,6 +1,9 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include "common.h"
+#include "simd.h"
+
 /*
     * TOKEN_ERROR is used to pass error to caller.
     * TOKEN_EOF is used to notify caller the file is ended.
@@ -34,9 +37,33 @@ typedef struct {
     int line;
 } Token;
 
-void initScanner(const char* source);
+// scanning loops that look at 16 or 32 chars at once on x86-64, the
+// widest the cpu supports is chosen when a scanner starts.
+typedef enum {
+    SCAN_SCALAR = SIMD_SCALAR,
+    SCAN_SSE2 = SIMD_SSE2,
+    SCAN_AVX2 = SIMD_AVX2,
+} ScanKernels;
+
+// scanning loops of one kernel set, see scanner.c
+typedef struct Kernels Kernels;
+
+// scanning state of one source, a scanner per source can run on each thread
+typedef struct {
+    const char* start;
+    const char* current;
+    // the NUL after the last char, the kernels never read past it
+    const char* end;
+    int line;
+    const Kernels* kernels;
+} Scanner;
+
+void initScanner(Scanner* scanner, const char* source);
+// override the kernels of scanners started after it, false if the cpu
+// doesn't support them. call it before scanning starts on other threads.
+bool useScanKernels(ScanKernels kernels);
 // lazy scan, only scan a token when one is needed.
-Token scanToken();
+Token scanToken(Scanner* scanner);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#include "simd.h"
+
+static bool cpuSupports(SimdLevel level) {
+    switch (level) {
+        case SIMD_SCALAR: return true;
+        #ifdef SIMD_X86
+        // sse2 is part of x86-64
+        case SIMD_SSE2: return true;
+        case SIMD_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+        #endif
+        default: return false;
+    }
+}
+
+bool chooseKernels(KernelChoice* choice, SimdLevel level) {
+    if (level < SIMD_SCALAR || level >= SIMD_LEVELS) return false;
+    if (choice->sets[level] == NULL || !cpuSupports(level)) return false;
+    choice->chosen = choice->sets[level];
+    return true;
+}
+
+const void* pickKernels(const KernelChoice* choice) {
+    if (choice->chosen != NULL) return choice->chosen;
+    for (int level = SIMD_LEVELS - 1; level > SIMD_SCALAR; level--) {
+        if (choice->sets[level] != NULL && cpuSupports((SimdLevel)level)) return choice->sets[level];
+    }
+    return choice->sets[SIMD_SCALAR];
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef clox_simd_h
+#define clox_simd_h
+
+#include "common.h"
+
+// choice between the kernel sets of a module, e.g. the scanner or
+// runColumns(). each set holds the same loops written for one instruction
+// set, the wide ones are only compiled in on x86-64.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SIMD_X86
+#endif
+
+typedef enum {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_LEVELS,
+} SimdLevel;
+
+// sets[level] is NULL for the ones a module doesn't have. chosen is set by
+// chooseKernels(), NULL picks the widest ones.
+typedef struct {
+    const void* sets[SIMD_LEVELS];
+    const void* chosen;
+} KernelChoice;
+
+// false if the module has no set for level or the cpu doesn't support it
+bool chooseKernels(KernelChoice* choice, SimdLevel level);
+// only reads, threads can pick kernels at the same time
+const void* pickKernels(const KernelChoice* choice);
+
+#endif
\ No newline at end of file
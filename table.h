@@ -0,0 +1,34 @@
+#ifndef clox_table_h
+#define clox_table_h
+
+#include "common.h"
+#include "value.h"
+
+typedef struct {
+    // NULL key with nil value is an empty slot, NULL key with true value is a tombstone.
+    ObjString* key;
+    Value value;
+} Entry;
+
+// hash table with open addressing and linear probing.
+// keys are interned strings, so keys are compared by pointer.
+typedef struct {
+    // live entries plus tombstones
+    int count;
+    int capacity;
+    Entry* entries;
+} Table;
+
+void initTable(Table* table);
+void freeTable(VM* vm, Table* table);
+bool tableGet(Table* table, ObjString* key, Value* value);
+// return true if key is newly added
+bool tableSet(VM* vm, Table* table, ObjString* key, Value value);
+bool tableDelete(Table* table, ObjString* key);
+// swap key for copy, a string with the same content and hash, or delete key
+// if copy is NULL. never allocates, the collector uses it to move strings.
+void tableReplaceKey(Table* table, ObjString* key, ObjString* copy);
+// look up a string by content, used to intern strings
+ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,29 @@
+#!/bin/sh
+# errors of --batch name the line of the file they come from, past blank
+# lines and on any worker. a failing case prints its name and the script
+# exits 1.
+# usage: test/batch.sh clox
+CLOX=${1:?usage: test/batch.sh clox}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+{
+    printf '1 + 1\n\n"a" + 1\n2 +\n'
+    awk 'BEGIN { for (i = 0; i < 300; i++) print i }'
+    printf -- '-"x"\n'
+} > "$DIR/lines.lox"
+
+"$CLOX" --batch --threads=4 "$DIR/lines.lox" > "$DIR/out" 2> "$DIR/err"
+status=$?
+cat > "$DIR/expected" <<'END'
+Operands of '+' must be number or string.
+[line 3] in script
+[line 4] Error at end: Expect expression.
+Operand must be a number.
+[line 305] in script
+END
+if [ $status != 65 ] || ! cmp -s "$DIR/err" "$DIR/expected"; then
+    echo "FAIL batch line numbers: status $status"
+    diff "$DIR/expected" "$DIR/err"
+    exit 1
+fi
@@ -0,0 +1,212 @@
+// runColumns() against results worked out in C: columns that mix numbers
+// with other values, rows that fail, and a chain of + over strings long
+// enough to build ropes. make test builds it with DEBUG_STRESS_GC, which
+// collects on every allocation and moves every young string it can.
+// a failing case prints its name and the program exits 1.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "column.h"
+#include "compiler.h"
+#include "object.h"
+#include "vm.h"
+
+// three blocks, the last one partly filled
+#define ROWS (COLUMN_BLOCK_ROWS * 2 + 100)
+#define COLUMNS 4
+#define CHAIN_TERMS 40
+
+static const char* columnNames[] = {"x", "y", "s", "t"};
+
+static VM vm;
+static Value* columns[COLUMNS];
+static Value results[ROWS];
+static bool failed[ROWS];
+// the inputs stay roots between the runs, runColumns() adds its own
+static ValueSpan inputs[COLUMNS];
+static bool passed = true;
+
+// x is a number but in a few rows, y always is
+static bool xIsNumber(int row) {
+    return row % 50 != 7 && row % 50 != 13;
+}
+
+static Value xValue(int row) {
+    if (row % 50 == 7) return OBJ_VAL(copyString(&vm, "x", 1));
+    if (row % 50 == 13) return NIL_VAL();
+    return NUMBER_VAL(row % 17 - 8);
+}
+
+static void sChars(char* chars, int row) {
+    int length = row % 9;
+    memset(chars, 'a' + row % 3, length);
+    chars[length] = '\0';
+}
+
+static void tChars(char* chars, int row) {
+    sprintf(chars, "t%d", row);
+}
+
+static Value inputValue(int column, int row) {
+    char chars[16];
+    switch (column) {
+        case 0: return xValue(row);
+        case 1: return NUMBER_VAL(row % 5);
+        case 2: sChars(chars, row); break;
+        default: tChars(chars, row); break;
+    }
+    return OBJ_VAL(copyString(&vm, chars, (int)strlen(chars)));
+}
+
+static void fail(const char* name, int row, const char* what) {
+    printf("FAIL %s: row %d %s\n", name, row, what);
+    passed = false;
+}
+
+// run source over every row, its errors go to errors
+static int run(const char* name, const char* source, char** errors) {
+    Chunk chunk;
+    initChunk(&chunk);
+    if (!compileColumns(&vm, source, columnNames, COLUMNS, &chunk)) {
+        printf("FAIL %s: does not compile\n", name);
+        exit(1);
+    }
+    size_t length;
+    vm.err = open_memstream(errors, &length);
+    if (vm.err == NULL) exit(1);
+    int failedCount = runColumns(&vm, &chunk, columns, COLUMNS, ROWS, results, failed);
+    fclose(vm.err);
+    vm.err = stderr;
+    freeChunk(&vm, &chunk);
+    return failedCount;
+}
+
+static int countLines(const char* text, const char* line) {
+    int count = 0;
+    for (const char* found = text; (found = strstr(found, line)) != NULL; found += strlen(line)) {
+        count++;
+    }
+    return count;
+}
+
+// rows where x isn't a number fail, the others go through the kernels
+static void mixedNumbers() {
+    char* errors;
+    int failedCount = run("mixed numbers", "x * 2 + y < 10", &errors);
+
+    int expectedFailed = 0;
+    for (int row = 0; row < ROWS; row++) {
+        if (!xIsNumber(row)) {
+            expectedFailed++;
+            if (!failed[row]) fail("mixed numbers", row, "did not fail");
+            if (!IS_NIL(results[row])) fail("mixed numbers", row, "failed but is not nil");
+            continue;
+        }
+        double x = AS_NUMBER(columns[0][row]);
+        double y = AS_NUMBER(columns[1][row]);
+        if (failed[row]) fail("mixed numbers", row, "failed");
+        if (!IS_BOOL(results[row]) || AS_BOOL(results[row]) != (x * 2 + y < 10)) {
+            fail("mixed numbers", row, "has the wrong result");
+        }
+    }
+    if (failedCount != expectedFailed) {
+        printf("FAIL mixed numbers: %d rows failed, expected %d\n", failedCount, expectedFailed);
+        passed = false;
+    }
+    if (countLines(errors, "Operands must be number.\n[line 1] in row ") != expectedFailed) {
+        printf("FAIL mixed numbers: expected an error per failed row\n%s", errors);
+        passed = false;
+    }
+    free(errors);
+}
+
+// == takes any two values, no row fails
+static void mixedEquality() {
+    char* errors;
+    int failedCount = run("mixed equality", "x == y - 8", &errors);
+    if (failedCount != 0 || errors[0] != '\0') {
+        printf("FAIL mixed equality: %d rows failed\n%s", failedCount, errors);
+        passed = false;
+    }
+    for (int row = 0; row < ROWS; row++) {
+        bool equal = xIsNumber(row) && AS_NUMBER(columns[0][row]) == AS_NUMBER(columns[1][row]) - 8;
+        if (!IS_BOOL(results[row]) || AS_BOOL(results[row]) != equal) {
+            fail("mixed equality", row, "has the wrong result");
+        }
+    }
+    free(errors);
+}
+
+// s + t + s + t + ... + "!", longer than ROPE_MIN_LENGTH in most rows
+static void stringChain() {
+    char source[CHAIN_TERMS * 4 + 8] = "";
+    for (int i = 0; i < CHAIN_TERMS; i++) strcat(source, i % 2 == 0 ? "s + " : "t + ");
+    strcat(source, "\"!\"");
+
+    char* errors;
+    int failedCount = run("string chain", source, &errors);
+    if (failedCount != 0) {
+        printf("FAIL string chain: %d rows failed\n%s", failedCount, errors);
+        passed = false;
+    }
+    free(errors);
+
+    // flattening allocates, keep the results alive while they are checked
+    ValueSpan roots[COLUMNS + 1];
+    memcpy(roots, inputs, sizeof(inputs));
+    roots[COLUMNS] = (ValueSpan){results, ROWS};
+    vm.roots = roots;
+    vm.rootCount = COLUMNS + 1;
+
+    char expected[CHAIN_TERMS * 16 + 2];
+    char s[16];
+    char t[16];
+    for (int row = 0; row < ROWS; row++) {
+        sChars(s, row);
+        tChars(t, row);
+        expected[0] = '\0';
+        for (int i = 0; i < CHAIN_TERMS; i++) strcat(expected, i % 2 == 0 ? s : t);
+        strcat(expected, "!");
+
+        int length = (int)strlen(expected);
+        if (!IS_STRING(results[row]) || AS_STRING(results[row])->length != length ||
+            memcmp(AS_CSTRING(&vm, results[row]), expected, length) != 0) {
+            fail("string chain", row, "has the wrong result");
+        }
+    }
+    vm.roots = inputs;
+    vm.rootCount = COLUMNS;
+}
+
+int main() {
+    initVM(&vm);
+    for (int c = 0; c < COLUMNS; c++) {
+        columns[c] = (Value*)malloc(sizeof(Value) * ROWS);
+        if (columns[c] == NULL) exit(1);
+    }
+    for (int c = 0; c < COLUMNS; c++) inputs[c] = (ValueSpan){columns[c], 0};
+    vm.roots = inputs;
+    vm.rootCount = COLUMNS;
+    for (int row = 0; row < ROWS; row++) {
+        for (int c = 0; c < COLUMNS; c++) {
+            columns[c][row] = inputValue(c, row);
+            inputs[c].count = row + 1;
+        }
+    }
+
+    for (int kernels = COLUMN_SCALAR; kernels <= COLUMN_AVX2; kernels++) {
+        if (!useColumnKernels((ColumnKernels)kernels)) continue;
+        mixedNumbers();
+        mixedEquality();
+        stringChain();
+    }
+
+    vm.roots = NULL;
+    vm.rootCount = 0;
+    freeVM(&vm);
+    for (int c = 0; c < COLUMNS; c++) free(columns[c]);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+#!/bin/sh
+# a chain of + reports the same runtime error on the same line as the chain
+# with every + in parentheses, which compiles to one OP_ADD each. checked in
+# the interpreter, the jit and, when libclox.a is next to clox, in C written
+# by --emit-c. a failing case prints its name and the script exits 1.
+# usage: test/errors.sh clox
+CLOX=${1:?usage: test/errors.sh clox}
+LIBCLOX="$(dirname "$CLOX")/libclox.a"
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+FAILED=0
+
+# stdout, stderr and status of a script
+run() {
+    "$CLOX" "$@" > "$DIR/out" 2>&1
+    echo "status $?" >> "$DIR/out"
+}
+
+emitted() {
+    "$CLOX" "$@" --emit-c="$DIR/script.c" "$DIR/script.lox" 2>&1 &&
+        ${CC:-cc} -std=gnu11 -I. "$DIR/script.c" "$LIBCLOX" -lm -o "$DIR/script" &&
+        "$DIR/script" > "$DIR/out" 2>&1
+    echo "status $?" >> "$DIR/out"
+}
+
+# name chain pairwise
+check() {
+    printf '%s' "$2" > "$DIR/chain.lox"
+    printf '%s' "$3" > "$DIR/pairwise.lox"
+    for flags in -O0 -O1 "-O0 --jit" --jit; do
+        run $flags "$DIR/pairwise.lox"
+        mv "$DIR/out" "$DIR/expected"
+        run $flags "$DIR/chain.lox"
+        if ! cmp -s "$DIR/out" "$DIR/expected"; then
+            echo "FAIL $1 ($flags)"
+            diff "$DIR/expected" "$DIR/out"
+            FAILED=1
+        fi
+    done
+    [ -f "$LIBCLOX" ] || return
+    for flags in -O0 -O1; do
+        cp "$DIR/pairwise.lox" "$DIR/script.lox"
+        emitted $flags
+        mv "$DIR/out" "$DIR/expected"
+        cp "$DIR/chain.lox" "$DIR/script.lox"
+        emitted $flags
+        if ! cmp -s "$DIR/out" "$DIR/expected"; then
+            echo "FAIL $1 (--emit-c $flags)"
+            diff "$DIR/expected" "$DIR/out"
+            FAILED=1
+        fi
+    done
+}
+
+check "failing middle +" \
+    '1 + 2 + "a" + 3 + 4' \
+    '((((1 + 2) + "a") + 3) + 4)'
+check "failing later operand" \
+    '1 + 2 + 3 + -"b" + 4' \
+    '(((1 + 2) + 3) + -"b") + 4'
+check "failing + before a failing operand" \
+    '"s" + 0 + (0.1 > "a") + 2' \
+    '(("s" + 0) + (0.1 > "a")) + 2'
+check "several lines" \
+    'nil + 0 +
+true +
+1' \
+    '((nil + 0) +
+true) +
+1'
+check "several lines, failing last +" \
+    '1 +
+2 +
+3 + "a" + nil' \
+    '(((1 +
+2) +
+3) + "a") + nil'
+check "failing operand on the next line" \
+    '"s" + 0 +
+(0.1 > "a") + 2' \
+    '(("s" + 0) +
+(0.1 > "a")) + 2'
+
+exit $FAILED
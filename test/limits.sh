@@ -0,0 +1,62 @@
+#!/bin/sh
+# expressions at the stack limit. the deepest one that fits runs the same
+# in the interpreter, the jit and from a .loxc cache, one slot deeper is
+# rejected when it compiles. a failing case prints its name and the
+# script exits 1.
+# usage: test/limits.sh clox
+CLOX=${1:?usage: test/limits.sh clox}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+FAILED=0
+
+# n nested '"a" + (' around inner, e.g. "a" + ("a" + ("a" + "b"))
+nested() {
+    awk -v n="$1" -v inner="$2" 'BEGIN {
+        for (i = 0; i < n; i++) printf "\"a\" + ("
+        printf "%s", inner
+        for (i = 0; i < n; i++) printf ")"
+    }' > "$DIR/$3.lox"
+}
+
+# name expected_status expected_stdout clox_flags...
+check() {
+    name=$1
+    status=$2
+    expected=$3
+    shift 3
+    output=$("$CLOX" "$@" 2> "$DIR/err")
+    actual=$?
+    if [ "$actual" != "$status" ] || [ "$output" != "$expected" ]; then
+        echo "FAIL $name: status $actual, expected $status"
+        head -c 200 "$DIR/err"
+        FAILED=1
+    fi
+}
+
+repeat() {
+    awk -v n="$1" -v s="$2" 'BEGIN { for (i = 0; i < n; i++) printf "%s", s }'
+}
+
+# "a" + "b" compiles to OP_CONSTANT, OP_ADD_CONST, which pushes "b" above
+# the deepest operand. at -O0 nothing is folded and every "a" waits on the
+# stack, 253 of them leave exactly room for it.
+nested 253 '"a" + "b"' fits
+FITS="$(repeat 254 a)b"
+check "fits -O0" 0 "$FITS" -O0 "$DIR/fits.lox"
+check "fits -O0 --jit" 0 "$FITS" -O0 --jit "$DIR/fits.lox"
+check "fits -O1" 0 "$FITS" "$DIR/fits.lox"
+"$CLOX" -O0 --compile-only "$DIR/fits.lox" || { echo "FAIL fits --compile-only"; FAILED=1; }
+check "fits .loxc" 0 "$FITS" "$DIR/fits.lox"
+
+nested 254 '"a" + "b"' deep
+check "too deep -O0" 65 "" -O0 "$DIR/deep.lox"
+check "too deep -O0 --jit" 65 "" -O0 --jit "$DIR/deep.lox"
+
+# a mixed + chain falls back to pairwise addition, which has to stay within
+# the operands of the chain
+nested 252 '"a" + "b" + 1' mixed
+check "mixed -O0" 70 "" -O0 "$DIR/mixed.lox"
+check "mixed -O0 --jit" 70 "" -O0 --jit "$DIR/mixed.lox"
+check "mixed -O1" 70 "" "$DIR/mixed.lox"
+
+exit $FAILED
@@ -0,0 +1,31 @@
+#!/bin/sh
+# --mem-stats counts each allocation of a run at the line of the instruction
+# that made it. a failing case prints its name and the script exits 1.
+# usage: test/memstats.sh clox
+CLOX=${1:?usage: test/memstats.sh clox}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+FAILED=0
+
+repeat() {
+    awk -v n="$1" -v s="$2" 'BEGIN { for (i = 0; i < n; i++) printf "%s", s }'
+}
+
+# run bytes of line in the table by line
+runBytes() {
+    awk -v line="$1" '/^line / { table = 1; next } table && $1 == line { print $4; exit }' "$DIR/err"
+}
+
+# the rope on line 1 is flattened by the == on line 5, the last instruction
+# before it that allocated is on line 1
+A=$(repeat 100 a)
+B=$(repeat 100 b)
+C=$(repeat 100 c)
+printf '(("%s" + "%s") + "%s")\n\n==\n\n"%s%s%s"\n' "$A" "$B" "$C" "$A" "$B" "$C" > "$DIR/equal.lox"
+"$CLOX" -O0 --mem-stats "$DIR/equal.lox" > /dev/null 2> "$DIR/err"
+if [ "$(runBytes 5)" != 301 ]; then
+    echo "FAIL flattened by ==: line 5 has $(runBytes 5) run bytes, expected 301"
+    FAILED=1
+fi
+
+exit $FAILED
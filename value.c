@@ -4,6 +4,7 @@
 #include "memory.h"
 #include "value.h"
 #include "object.h"
+#include "vm.h"
 
 void initValueArray(ValueArray* array) {
     array->count = 0;
@@ -11,34 +12,55 @@ void initValueArray(ValueArray* array) {
     array->values = NULL;
 }
 
-void writeValueArray(ValueArray* array, Value value) {
+void writeValueArray(VM* vm, ValueArray* array, Value value) {
     if (array->capacity == array->count) {
         int oldCapacity = array->capacity;
         array->capacity = GROW_CAPACITY(oldCapacity);
-        array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+        array->values = GROW_ARRAY(vm, Value, array->values, oldCapacity, array->capacity, MEM_CONSTANTS);
     }
 
     array->values[array->count] = value;
     array->count++;
 }
 
-void freeValueArray(ValueArray* array) {
-    FREE_ARRAY(Value, array->values, array->capacity);
+void freeValueArray(VM* vm, ValueArray* array) {
+    FREE_ARRAY(vm, Value, array->values, array->capacity, MEM_CONSTANTS);
     initValueArray(array);
 }
 
-void printValue(Value value) {
-    switch(value.type) {
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
-        case VAL_BOOL: printf(AS_BOOL(value) ? "true" : "false"); break;
-        case VAL_NIL: printf("nil"); break;
-        case VAL_OBJ: printObj(value); break;
-        default: return;
+void printValue(VM* vm, Value value) {
+    if (IS_NUMBER(value)) {
+        fprintf(vm->out, "%g", AS_NUMBER(value));
+    } else if (IS_BOOL(value)) {
+        fprintf(vm->out, AS_BOOL(value) ? "true" : "false");
+    } else if (IS_NIL(value)) {
+        fprintf(vm->out, "nil");
+    } else if (IS_OBJ(value)) {
+        printObj(vm, value);
     }
 }
 
+#ifdef NAN_BOXING
+
+bool valueEqual(VM* vm, Value value1, Value value2) {
+    // numbers are compared as doubles, NaN != NaN and 0 == -0.
+    if (IS_NUMBER(value1) && IS_NUMBER(value2)) {
+        return AS_NUMBER(value1) == AS_NUMBER(value2);
+    }
+    // nil, true and false have exactly one encoding each,
+    // interned strings with equal content are the same object.
+    if (value1 == value2) return true;
+    // ropes are not interned
+    if (IS_STRING(value1) && IS_STRING(value2)) {
+        return stringsEqual(vm, AS_STRING(value1), AS_STRING(value2));
+    }
+    return false;
+}
+
+#else
+
 // can't use memcmp(), because value of unused bits are undefined.
-bool valueEqual(Value value1, Value value2) {
+bool valueEqual(VM* vm, Value value1, Value value2) {
     if (value1.type != value2.type) {
         return false;
     }
@@ -47,21 +69,14 @@ bool valueEqual(Value value1, Value value2) {
         case VAL_NIL: return true;
         case VAL_NUMBER: return AS_NUMBER(value1) == AS_NUMBER(value2);
         case VAL_OBJ:
-            Obj* obj1 = AS_OBJ(value1);
-            Obj* obj2 = AS_OBJ(value2);
-            if (obj1->type != obj2->type) {
-                return false;
-            }
-            switch(obj1->type) {
-                case OBJ_STRING:
-                    ObjString* s1 = AS_STRING(value1);
-                    ObjString* s2 = AS_STRING(value2);
-                    if (s1->length != s2->length) {
-                        return false;
-                    }
-                    return memcmp(s1->chars, s2->chars, s1->length) == 0;
-                default: return false;
+            // interned strings with equal content are the same object,
+            // ropes are not interned.
+            if (IS_STRING(value1) && IS_STRING(value2)) {
+                return stringsEqual(vm, AS_STRING(value1), AS_STRING(value2));
             }
+            return AS_OBJ(value1) == AS_OBJ(value2);
         default: return false;
     }
-}
\ No newline at end of file
+}
+
+#endif
\ No newline at end of file
@@ -5,6 +5,67 @@
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
+// see vm.h, everything that allocates takes the vm it allocates for
+typedef struct VM VM;
+
+#ifdef NAN_BOXING
+
+// a double whose exponent bits and quiet bit are all set is a quiet NaN,
+// the remaining bits are free to hold non-number values.
+// bit 50 is also set to stay clear of the "Intel FP Indefinite" NaN.
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN     ((uint64_t)0x7ffc000000000000)
+
+// tags live in the lowest two bits of the payload
+#define TAG_NIL   1 // 01
+#define TAG_FALSE 2 // 10
+#define TAG_TRUE  3 // 11
+
+// number: any bit pattern that is not a quiet NaN
+// nil/true/false: QNAN | tag
+// object: SIGN_BIT | QNAN | pointer, pointers only use the low 48 bits
+typedef uint64_t Value;
+
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+// convert c value to clox value
+#define BOOL_VAL(value) ((value) ? TRUE_VAL : FALSE_VAL)
+#define NIL_VAL() ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define NUMBER_VAL(value) numToValue(value)
+#define OBJ_VAL(value) ((Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(value)))
+
+// convert clox value to c value
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) valueToNum(value)
+#define AS_OBJ(value) ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+// true and false only differ in the lowest bit
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value) ((value) == NIL_VAL())
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+// type punning through a union, compilers turn it into a plain register move.
+static inline double valueToNum(Value value) {
+    union {
+        uint64_t bits;
+        double num;
+    } data;
+    data.bits = value;
+    return data.num;
+}
+
+static inline Value numToValue(double num) {
+    union {
+        uint64_t bits;
+        double num;
+    } data;
+    data.num = num;
+    return data.bits;
+}
+
+#else
 
 typedef enum {
     VAL_BOOL,
@@ -38,6 +99,8 @@ typedef struct {
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 
+#endif
+
 typedef struct {
     int capacity;
     int count;
@@ -45,9 +108,10 @@ typedef struct {
 } ValueArray;
 
 void initValueArray(ValueArray* array);
-void writeValueArray(ValueArray* array, Value value);
-void freeValueArray(ValueArray* array);
-void printValue(Value value);
-bool valueEqual(Value value1, Value value2);
+void writeValueArray(VM* vm, ValueArray* array, Value value);
+void freeValueArray(VM* vm, ValueArray* array);
+// to vm->out
+void printValue(VM* vm, Value value);
+bool valueEqual(VM* vm, Value value1, Value value2);
 
 #endif
\ No newline at end of file
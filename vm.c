@@ -1,45 +1,46 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 
 #include "vm.h"
+#include "compiler.h"
 #include "value.h"
 #include "common.h"
 #include "debug.h"
 #include "object.h"
 #include "memory.h"
+#include "sampler.h"
+#include "jit.h"
 
-// global variable
-VM vm;
-
-static void resetStack() {
-    vm.stackTop = vm.stack;
+// vm->stack[0] is reserved, see STACK_BASE.
+static void resetStack(VM* vm) {
+    vm->stackTop = STACK_BASE(vm);
 }
 
-// peek value stack
-static Value peek(int offset) {
-    return vm.stackTop[-1-offset];
+void push(VM* vm, Value value) {
+    *vm->stackTop++ = value;
 }
 
-static void push(Value value) {
-    *vm.stackTop++ = value;
+Value pop(VM* vm) {
+    return *--vm->stackTop;
 }
 
-static Value pop() {
-    return *--vm.stackTop;
+static Value peek(VM* vm, int offset) {
+    return vm->stackTop[-1-offset];
 }
 
-static void runtimeError(const char* format, ...) {
+void runtimeError(VM* vm, const char* format, ...) {
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->err, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->err);
 
-    size_t instruction = vm.ip - vm.chunk->code -1;
-    int line = vm.chunk->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
-    resetStack();
+    size_t instruction = vm->ip - vm->chunk->code -1;
+    int line = getLine(vm->chunk, instruction);
+    fprintf(vm->err, "[line %d] in script\n", line);
+    resetStack(vm);
 }
 
 // what is considered false.
@@ -52,122 +53,221 @@ static bool toBool(Value value) {
     return !isFalsey(value);
 }
 
-static void concatenate() {
-    ObjString* s2 = AS_STRING(pop());
-    ObjString* s1 = AS_STRING(pop());
-    int length = s1->length + s2->length;
-    char* chars = ALLOCATE_ARRAY(char, length+1);
-    memcpy(chars, s1->chars, s1->length);
-    memcpy(chars + s1->length, s2->chars, s2->length);
-    chars[length] = '\0';
-
-    ObjString* objString = takeString(chars, length);
-    push(OBJ_VAL(objString));
-}
-
-static InterpretResult run() {
-    #define READ_BYTE() (*vm.ip++)
-    #define READ_CONST() (vm.chunk->constants.values[READ_BYTE()])
-    #define BINARY_OP(type, op) do { \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtimeError("Operands must be number."); \
-            return INTERPRET_RUNTIME_ERROR; \
-        } \
-        double b = AS_NUMBER(pop()); \
-        double a = AS_NUMBER(pop()); \
-        push(type(a op b)); \
-    } while(false)
-
-
-    for (;;) {
-        #ifdef DEBUG_PRINT_VALUE_STACK
-            printValueStack(vm.stack, vm.stackTop);
-        #endif
-
-        #ifdef DEBUG_DISASSEMBLE_CHUNK
-            disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
-        #endif
-
-        uint8_t instruction = READ_BYTE();
-
-        switch(instruction) {
-            case OP_RETURN:
-                printValue(pop());
-                printf("\n");
-                return INTERPRET_SUCCESS;
-            // arithmetic
-            case OP_CONSTANT: push(READ_CONST()); break;
-
-            case OP_NEGATE: 
-                if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(NUMBER_VAL(-AS_NUMBER(pop()))); 
-                break;
-            case OP_ADD: 
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                    concatenate();
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(pop());
-                    double a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a+b));
-                } else {
-                    runtimeError("Operands of '+' must be number or string.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE: BINARY_OP(NUMBER_VAL, /); break;
-
-            case OP_TRUE: push(BOOL_VAL(true)); break;
-            case OP_FALSE: push(BOOL_VAL(false)); break;
-            case OP_NIL: push(NIL_VAL()); break;
-
-            case OP_NOT: push(BOOL_VAL(isFalsey(pop()))); break;
-            // TODO
-            case OP_AND: break;
-            case OP_OR: break;
-
-            case OP_EQUAL:
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valueEqual(a, b)));
-                break;
-            case OP_LESS: BINARY_OP(BOOL_VAL, <); break;
-            case OP_GREATER: BINARY_OP(BOOL_VAL, >); break;
+// a and b are stack slots, allocating can trigger a collection and move
+// young operands, so they are read through the slots once the result exists.
+// long results become ropes, a chain of + doesn't copy the growing
+// string over and over.
+static ObjString* concatenateSlots(VM* vm, Value* a, Value* b) {
+    int length = AS_STRING(*a)->length + AS_STRING(*b)->length;
+    ObjString* result;
+
+    if (length >= ROPE_MIN_LENGTH) {
+        result = newRope(vm, length);
+        result->left = AS_STRING(*a);
+        result->right = AS_STRING(*b);
+    } else {
+        // both operands are shorter than ROPE_MIN_LENGTH, so they are flat
+        result = newString(vm, length);
+        ObjString* s1 = AS_STRING(*a);
+        ObjString* s2 = AS_STRING(*b);
+        memcpy(result->chars, s1->chars, s1->length);
+        memcpy(result->chars + s1->length, s2->chars, s2->length);
+        result = internString(vm, result);
+    }
+    return result;
+}
+
+void concatenate(VM* vm) {
+    ObjString* result = concatenateSlots(vm, vm->stackTop - 2, vm->stackTop - 1);
+    pop(vm);
+    pop(vm);
+    push(vm, OBJ_VAL(result));
+}
+
+// top count values are operands of a + chain, replace them with the sum.
+// strings are concatenated in one pass, anything else is added pairwise from
+// the left to report the same error as a chain of OP_ADD.
+bool addN(VM* vm, int count) {
+    Value* operands = vm->stackTop - count;
+
+    int length = 0;
+    bool strings = true;
+    for (int i = 0; i < count; i++) {
+        if (!IS_STRING(operands[i])) {
+            strings = false;
+            break;
         }
+        length += AS_STRING(operands[i])->length;
+    }
+
+    if (strings) {
+        // a long first operand is usually the sum of the previous OP_ADD_N of
+        // a longer chain, only the rest is copied and hung next to it in a
+        // rope. copying it too would make the chain quadratic.
+        int first = 0;
+        if (AS_STRING(operands[0])->length >= ROPE_MIN_LENGTH) {
+            first = 1;
+            length -= AS_STRING(operands[0])->length;
+        }
+        // allocating can move young operands, read them afterwards
+        ObjString* result = newString(vm, length);
+        char* dest = result->chars;
+        for (int i = first; i < count; i++) {
+            ObjString* string = AS_STRING(operands[i]);
+            memcpy(dest, AS_CSTRING(vm, operands[i]), string->length);
+            dest += string->length;
+        }
+        operands[first] = OBJ_VAL(internString(vm, result));
+        if (first == 1) {
+            operands[0] = OBJ_VAL(concatenateSlots(vm, &operands[0], &operands[1]));
+        }
+        vm->stackTop = operands + 1;
+        return true;
+    }
+
+    for (int i = 1; i < count; i++) {
+        Value a = operands[0];
+        Value b = operands[i];
+        if (IS_NUMBER(a) && IS_NUMBER(b)) {
+            operands[0] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+        } else if (IS_STRING(a) && IS_STRING(b)) {
+            // in place, the depth checks leave no room above the operands
+            operands[0] = OBJ_VAL(concatenateSlots(vm, &operands[0], &operands[i]));
+        } else {
+            runtimeError(vm, "Operands of '+' must be number or string.");
+            return false;
+        }
+    }
+    vm->stackTop = operands + 1;
+    return true;
+}
+
+// the plain loop and the ones with profilers compiled in, choosing between
+// them once per chunk keeps the plain one free of profiling checks.
+#define RUN run
+#include "run.h"
+#define RUN runSampled
+#define SAMPLE_IP
+#include "run.h"
+#define RUN runProfiled
+#define PROFILE_OPS
+#define SAMPLE_IP
+#include "run.h"
+
+// + of anything but two numbers, the operands are the top two values
+bool addValues(VM* vm) {
+    if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
+        concatenate(vm);
+        return true;
     }
+    runtimeError(vm, "Operands of '+' must be number or string.");
+    return false;
+}
 
-    #undef READ_BYTE
-    #undef READ_CONST
-    #undef BINARY_OP
+void equalValues(VM* vm, bool negate) {
+    Value b = pop(vm);
+    Value a = pop(vm);
+    push(vm, BOOL_VAL(valueEqual(vm, a, b) != negate));
+}
+
+void printResult(VM* vm) {
+    Value result = pop(vm);
+    printValue(vm, result);
+    fprintf(vm->out, "\n");
+}
+
+int currentLine(VM* vm) {
+    if (vm->chunk != NULL) {
+        if (vm->ip == vm->chunk->code) return getLine(vm->chunk, 0);
+        return getLine(vm->chunk, vm->ip - vm->chunk->code - 1);
+    }
+    return compilingLine(vm);
 }
 
-void initVM() {
-    resetStack();
-    vm.objects = NULL;
+void initVM(VM* vm) {
+    resetStack(vm);
+    vm->chunk = NULL;
+    vm->objects = NULL;
+    initTable(&vm->strings);
+    vm->compiler = NULL;
+    vm->roots = NULL;
+    vm->rootCount = 0;
+    vm->out = stdout;
+    vm->err = stderr;
+    vm->firstLine = 1;
+
+    vm->bytesAllocated = 0;
+    vm->nextGC = 1024 * 1024;
+    vm->grayCount = 0;
+    vm->grayCapacity = 0;
+    vm->grayStack = NULL;
+    vm->gcStats = (GCStats){0};
+    vm->collecting = false;
+    vm->memStats = (MemStats){0};
+    vm->opProfile = (OpProfile){0};
+
+    initNursery(vm);
 }
 
-void freeVM() {
-    freeObjects();
+void freeVM(VM* vm) {
+    #ifdef DEBUG_PROFILE_OPCODE_PAIRS
+    printOpcodePairs();
+    #endif
+    #ifdef DEBUG_LOG_GC
+    printGCStats(vm);
+    #endif
+    freeTable(vm, &vm->strings);
+    freeObjects(vm);
+    freeNursery(vm);
 }
 
-InterpretResult interpret(const char* source) {
+InterpretResult interpret(VM* vm, const char* source) {
     Chunk chunk;
     initChunk(&chunk);
 
-    if (!compile(source, &chunk)) {
-        freeChunk(&chunk);
+    if (!compile(vm, source, &chunk)) {
+        freeChunk(vm, &chunk);
         return INTERPRET_COMPILE_ERROR;
     }
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
+    InterpretResult result = interpretChunk(vm, &chunk);
+
+    freeChunk(vm, &chunk);
+    return result;
+}
 
-    InterpretResult result = run();
+InterpretResult interpretChunk(VM* vm, Chunk* chunk) {
+    vm->chunk = chunk;
+    vm->ip = vm->chunk->code;
+    resetStack(vm);
 
-    freeChunk(&chunk);
+    bool sampling = samplerRunning();
+    if (sampling) samplerEnterChunk(chunk);
+
+    // the profilers need the interpreter, the jit only runs without them
+    InterpretResult result;
+    JitCode jit;
+    if (vm->opProfile.enabled) {
+        vm->opProfile.offsetCounts = (uint64_t*)calloc(chunk->count, sizeof(uint64_t));
+        if (vm->opProfile.offsetCounts == NULL) exit(1);
+        result = runProfiled(vm);
+    } else if (sampling) {
+        result = runSampled(vm);
+    } else if (jitMode != JIT_OFF && compileJit(chunk, &jit)) {
+        result = jitMode == JIT_CHECK ? checkJit(vm, chunk, &jit, run) : jit.function(vm);
+        freeJit(&jit);
+    } else {
+        result = run(vm);
+    }
+
+    // samples from here on are outside of the chunk
+    samplerIp = NULL;
+    if (sampling) samplerLeaveChunk(chunk);
+    if (vm->opProfile.enabled) {
+        printOpProfile(&vm->opProfile, chunk);
+        free(vm->opProfile.offsetCounts);
+        vm->opProfile.offsetCounts = NULL;
+    }
+    vm->chunk = NULL;
     return result;
 }
\ No newline at end of file
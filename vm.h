@@ -1,19 +1,86 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include <stdio.h>
+
 #include "chunk.h"
 #include "value.h"
-#include "compiler.h"
+#include "table.h"
+#include "memory.h"
+#include "debug.h"
 
 #define STACK_MAX 256
 
 typedef struct {
+    int collections;
+    size_t bytesReclaimed;
+    int minorCollections;
+    size_t bytesPromoted;
+    // seconds
+    double totalPause;
+    double maxPause;
+} GCStats;
+
+// state of one compile(), see compiler.c
+typedef struct Compiler Compiler;
+
+// values outside the stack the collector has to see, e.g. the columns
+// runColumns() works on. young objects in them are moved in place.
+typedef struct {
+    Value* values;
+    int count;
+} ValueSpan;
+
+// one interpreter with its own stack and heap. vms share no state, one per
+// thread can compile and run at the same time. a chunk from shareChunk()
+// can be run by any number of them at once.
+struct VM {
     Chunk* chunk;
     uint8_t* ip;
+    // stack[0] is reserved for run(), see STACK_BASE.
     Value stack[STACK_MAX];
     Value* stackTop;
     Obj* objects;
-} VM;
+    // interned strings, used as a set, holds weak references
+    Table strings;
+    // compile() running on this vm, its chunk is a root
+    Compiler* compiler;
+    // spans of values that are roots as well, e.g. set by runColumns()
+    ValueSpan* roots;
+    int rootCount;
+    // results and error messages of scripts, stdout and stderr unless
+    // redirected, e.g. to buffer the output of a script run on a thread
+    FILE* out;
+    FILE* err;
+    // line number of the first line of the source compile() is given, errors
+    // of a script cut out of a larger file report the lines of the file
+    int firstLine;
+
+    // garbage collector
+    // bytes currently allocated through reallocate()
+    size_t bytesAllocated;
+    // collect once bytesAllocated passes this
+    size_t nextGC;
+    // marked objects whose references are not traced yet
+    int grayCount;
+    int grayCapacity;
+    Obj** grayStack;
+    // set while objects are moved or freed, allocations must not collect then
+    bool collecting;
+    GCStats gcStats;
+
+    // young generation, see allocateYoung()
+    uint8_t* nursery;
+    uint8_t* nurseryTop;
+    uint8_t* nurseryEnd;
+
+    MemStats memStats;
+    OpProfile opProfile;
+};
+
+// bottom of the value stack, run() keeps the top of the stack in a local and
+// spills it one slot down on push, vm->stack[0] takes the spill of an empty stack.
+#define STACK_BASE(vm) ((vm)->stack + 1)
 
 typedef enum {
     INTERPRET_SUCCESS,
@@ -21,10 +88,27 @@ typedef enum {
     INTERPRET_RUNTIME_ERROR,
 } InterpretResult;
 
-void initVM();
-void freeVM();
-InterpretResult interpret(const char* source);
-
-extern VM vm;
+void initVM(VM* vm);
+void freeVM(VM* vm);
+InterpretResult interpret(VM* vm, const char* source);
+// run an already compiled chunk, the caller keeps ownership of it.
+// constants of chunk are only kept alive by the collector while it runs,
+// unless it is a shared chunk.
+InterpretResult interpretChunk(VM* vm, Chunk* chunk);
+// source line of the instruction being run or the token being compiled,
+// 0 when neither.
+int currentLine(VM* vm);
+void push(VM* vm, Value value);
+Value pop(VM* vm);
+// slow paths of run(), also called from jit and emitted C code. they work on
+// vm->stackTop and report errors with the line of vm->ip.
+void runtimeError(VM* vm, const char* format, ...);
+void concatenate(VM* vm);
+bool addN(VM* vm, int count);
+bool addValues(VM* vm);
+// replace the top two values with whether they are (not) equal
+void equalValues(VM* vm, bool negate);
+// pop the result of the script and print it
+void printResult(VM* vm);
 
 #endif
\ No newline at end of file